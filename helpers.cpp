@@ -9,6 +9,12 @@
 #include <QMouseEvent>
 #include <QWheelEvent>
 #include <QAction>
+#include <QCollator>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QSet>
+#include <QtConcurrent/QtConcurrent>
+#include <algorithm>
 #include <cmath>
 #include "helpers.h"
 
@@ -203,6 +209,24 @@ QVariantMap Helpers::rectToVmap(const QRect &r) {
     };
 }
 
+bool Helpers::isMediaFile(const QString &fileName)
+{
+    static const QSet<QString> extensions {
+        // video
+        "3g2", "3gp", "asf", "avi", "divx", "f4v", "flv", "h264", "hevc",
+        "m2ts", "m2v", "m4v", "mkv", "mov", "mp4", "mpeg", "mpg", "mts",
+        "mxf", "ogm", "ogv", "rm", "rmvb", "ts", "vob", "webm", "wmv", "y4m",
+        // audio
+        "aac", "ac3", "aif", "aiff", "alac", "ape", "au", "dts", "eac3",
+        "flac", "m4a", "mka", "mp2", "mp3", "mpc", "oga", "ogg", "opus",
+        "tta", "wav", "wma", "wv"
+    };
+    int dot = fileName.lastIndexOf('.');
+    if (dot < 0)
+        return false;
+    return extensions.contains(fileName.mid(dot + 1).toLower());
+}
+
 
 
 LogoDrawer::LogoDrawer(QObject *parent)
@@ -310,6 +334,131 @@ void LogoWidget::resizeGL(int w, int h)
 
 
 
+// Files are sent in batches of this many, or whatever was found in this many
+// milliseconds, so that the playlist isn't rebuilt for every file.
+static const int scanBatchSize = 500;
+static const int scanBatchInterval = 250;
+
+struct DirectoryScanner::Walk {
+    int generation;
+    bool sentFirst;
+    QList<QUrl> batch;
+    QElapsedTimer sinceFlush;
+};
+
+DirectoryScanner::DirectoryScanner(QObject *parent)
+    : QObject(parent)
+{
+    connect(this, &DirectoryScanner::batchScanned,
+            this, &DirectoryScanner::self_batchScanned,
+            Qt::QueuedConnection);
+}
+
+DirectoryScanner::~DirectoryScanner()
+{
+    cancel();
+    for (QFuture<void> &f : scans)
+        f.waitForFinished();
+}
+
+void DirectoryScanner::scan(const QString &root)
+{
+    int generation = generation_.fetchAndAddOrdered(1) + 1;
+    auto isDone = [](const QFuture<void> &f) { return f.isFinished(); };
+    scans.erase(std::remove_if(scans.begin(), scans.end(), isDone),
+                scans.end());
+    scans.append(QtConcurrent::run(&walkers, [this, root, generation]() {
+        Walk state;
+        state.generation = generation;
+        state.sentFirst = false;
+        state.sinceFlush.start();
+        walk(listDirectory(root), state);
+        flush(state, true);
+    }));
+}
+
+void DirectoryScanner::cancel()
+{
+    generation_.fetchAndAddOrdered(1);
+}
+
+DirectoryScanner::Listing DirectoryScanner::listDirectory(const QString &path)
+{
+    Listing listing;
+    QFileInfoList entries = QDir(path).entryInfoList(QDir::Files | QDir::Dirs
+                                                     | QDir::NoDotAndDotDot
+                                                     | QDir::Readable);
+    QCollator collator;
+    collator.setNumericMode(true);
+    collator.setCaseSensitivity(Qt::CaseInsensitive);
+    std::sort(entries.begin(), entries.end(),
+              [&collator](const QFileInfo &a, const QFileInfo &b) {
+        return collator.compare(a.fileName(), b.fileName()) < 0;
+    });
+    for (const QFileInfo &info : entries) {
+        if (info.isDir()) {
+            // links to directories may well point back up the tree
+            if (!info.isSymLink())
+                listing.dirs.append(info.absoluteFilePath());
+        } else if (Helpers::isMediaFile(info.fileName())) {
+            listing.files.append(info.absoluteFilePath());
+        }
+    }
+    return listing;
+}
+
+void DirectoryScanner::walk(const Listing &listing, Walk &state)
+{
+    for (const QString &file : listing.files) {
+        state.batch.append(QUrl::fromLocalFile(file));
+        flush(state, !state.sentFirst);
+    }
+    if (listing.dirs.isEmpty() || isStale(state.generation))
+        return;
+
+    // List the subdirectories side by side, but descend into them in order
+    // so that the files come out sorted.
+    QFuture<Listing> children = QtConcurrent::mapped(listing.dirs,
+                                                     listDirectory);
+    for (int i = 0; i < listing.dirs.count(); i++) {
+        if (isStale(state.generation)) {
+            children.cancel();
+            return;
+        }
+        walk(children.resultAt(i), state);
+        flush(state, false);
+    }
+}
+
+void DirectoryScanner::flush(Walk &state, bool force)
+{
+    if (state.batch.isEmpty())
+        return;
+    if (!force && state.batch.count() < scanBatchSize
+            && state.sinceFlush.elapsed() < scanBatchInterval)
+        return;
+    if (!isStale(state.generation))
+        emit batchScanned(state.batch, !state.sentFirst, state.generation);
+    state.batch.clear();
+    state.sentFirst = true;
+    state.sinceFlush.restart();
+}
+
+bool DirectoryScanner::isStale(int generation) const
+{
+    return generation != generation_.load();
+}
+
+void DirectoryScanner::self_batchScanned(QList<QUrl> files, bool first,
+                                         int generation)
+{
+    // batches may still be queued from a scan that was since replaced
+    if (!isStale(generation))
+        emit filesFound(files, first);
+}
+
+
+
 // For the sake of optimizing 0.0001% of execution time, let's create a
 // tree out of the format string, so we don't need to do string operations
 // all the time other than those we need to.
@@ -416,7 +565,7 @@ private:
 
 
 
-DisplayParser::DisplayParser() : node(NULL)
+DisplayParser::DisplayParser() : node(NULL), revision_(0)
 {
 
 }
@@ -428,6 +577,7 @@ DisplayParser::~DisplayParser()
 
 void DisplayParser::takeFormatString(QString fmt)
 {
+    ++revision_;
     int length = fmt.length();
     int position = 0;
 
@@ -534,6 +684,11 @@ void DisplayParser::takeFormatString(QString fmt)
     dumpGatheredData(gathered, current, true);
 }
 
+int DisplayParser::revision() const
+{
+    return revision_;
+}
+
 QString DisplayParser::parseMetadata(QVariantMap metaData,
                                      QString displayString,
                                      Helpers::FileType fileType)
@@ -782,3 +937,75 @@ QList<AudioDevice> AudioDevice::listFromVList(const QVariantList &list)
     return audioDevices;
 }
 
+
+
+QString MediaTrack::typeName() const
+{
+    switch (type) {
+    case VideoTrack: return "video";
+    case AudioTrack: return "audio";
+    case SubtitleTrack: return "sub";
+    default: return QString();
+    }
+}
+
+MediaTrack::Type MediaTrack::typeFromName(const QString &name)
+{
+    if (name == "video")
+        return VideoTrack;
+    if (name == "audio")
+        return AudioTrack;
+    if (name == "sub")
+        return SubtitleTrack;
+    return UnknownTrack;
+}
+
+QString MediaTrack::displayString() const
+{
+    QString output = QString("%1: ").arg(id);
+    if (!codec.isEmpty())
+        output.append(QString("[%1] ").arg(codec));
+    if (!lang.isEmpty())
+        output.append(QString("%1 ").arg(lang));
+    if (!title.isEmpty())
+        output.append(QString("- %1 ").arg(title));
+    return output;
+}
+
+QVariantMap MediaTrack::toVMap() const
+{
+    // the same keys as mpv uses, so that older caches of its lists still read
+    return QVariantMap({{"id", (qlonglong)id}, {"type", typeName()},
+                        {"codec", codec}, {"lang", lang}, {"title", title}});
+}
+
+void MediaTrack::fromVMap(const QVariantMap &map)
+{
+    id = map.value("id", -1).toLongLong();
+    type = typeFromName(map.value("type").toString());
+    codec = map.value("codec").toString();
+    lang = map.value("lang").toString();
+    title = map.value("title").toString();
+}
+
+bool MediaTrack::operator ==(const MediaTrack &other) const
+{
+    return id == other.id && type == other.type && codec == other.codec
+            && lang == other.lang && title == other.title;
+}
+
+QVariantMap MediaChapter::toVMap() const
+{
+    return QVariantMap({{"time", time}, {"title", title}});
+}
+
+void MediaChapter::fromVMap(const QVariantMap &map)
+{
+    time = map.value("time").toDouble();
+    title = map.value("title").toString();
+}
+
+bool MediaChapter::operator ==(const MediaChapter &other) const
+{
+    return time == other.time && title == other.title;
+}
@@ -4,8 +4,11 @@
 #include <QObject>
 #include <QWidget>
 #include <QList>
+#include <QVector>
 #include <QUrl>
 #include <QUuid>
+#include <QFuture>
+#include <QThreadPool>
 #include <QOpenGLWidget>
 
 class QFileDialog;
@@ -23,6 +26,7 @@ namespace Helpers {
                         double timeEnd);
     QRect vmapToRect(const QVariantMap &m);
     QVariantMap rectToVmap(const QRect &r);
+    bool isMediaFile(const QString &fileName);
 
     enum TitlePrefix { PrefixFullPath, PrefixFileName, NoPrefix };
     enum ControlHiding { NeverShown, ShowWhenMoving, ShowWhenHovering,
@@ -67,6 +71,43 @@ private:
     QString logoUrl;
 };
 
+// Walks a directory tree on a thread pool of its own, listing sibling
+// directories in parallel on the global pool, and streams naturally-sorted
+// media files back to the gui thread.  The first file found is delivered on
+// its own.  The walk waits for listings, so it is kept off the global pool
+// in order that it never holds a thread the listings need.
+class DirectoryScanner : public QObject {
+    Q_OBJECT
+public:
+    explicit DirectoryScanner(QObject *parent = 0);
+    ~DirectoryScanner();
+    void scan(const QString &root);
+    void cancel();
+
+signals:
+    void filesFound(QList<QUrl> files, bool first);
+    void batchScanned(QList<QUrl> files, bool first, int generation);
+
+private:
+    struct Listing {
+        QStringList files;
+        QStringList dirs;
+    };
+    struct Walk;
+    static Listing listDirectory(const QString &path);
+    void walk(const Listing &listing, Walk &state);
+    void flush(Walk &state, bool force);
+    bool isStale(int generation) const;
+
+private slots:
+    void self_batchScanned(QList<QUrl> files, bool first, int generation);
+
+private:
+    QAtomicInt generation_;
+    QThreadPool walkers;
+    QList<QFuture<void>> scans;
+};
+
 class DisplayNode;
 class DisplayParser {
 public:
@@ -76,8 +117,10 @@ public:
     void takeFormatString(QString fmt);
     QString parseMetadata(QVariantMap metaData, QString displayString,
                           Helpers::FileType fileType);
+    int revision() const;
 private:
     DisplayNode *node;
+    int revision_;
 };
 
 class TrackInfo {
@@ -186,6 +229,69 @@ private:
 };
 
 
+// One entry of mpv's track-list, keeping only what the gui uses.
+class MediaTrack {
+public:
+    enum Type { UnknownTrack, VideoTrack, AudioTrack, SubtitleTrack };
+
+    MediaTrack() : id(-1), type(UnknownTrack) {}
+    int64_t id;
+    Type type;
+    QString codec;
+    QString lang;
+    QString title;
+
+    QString typeName() const;
+    static Type typeFromName(const QString &name);
+    QString displayString() const;
+
+    QVariantMap toVMap() const;
+    void fromVMap(const QVariantMap &map);
+    bool operator ==(const MediaTrack &other) const;
+};
+typedef QVector<MediaTrack> MediaTrackList;
+
+// One entry of mpv's chapter-list.
+class MediaChapter {
+public:
+    MediaChapter() : time(0) {}
+    double time;
+    QString title;
+
+    QVariantMap toVMap() const;
+    void fromVMap(const QVariantMap &map);
+    bool operator ==(const MediaChapter &other) const;
+};
+typedef QVector<MediaChapter> MediaChapterList;
+
+// Conversions for storing the lists above as variants.
+namespace Helpers {
+template <class T> QVector<T> listFromVList(const QVariantList &list)
+{
+    QVector<T> items;
+    items.reserve(list.count());
+    for (const QVariant &v : list) {
+        T item;
+        item.fromVMap(v.toMap());
+        items.append(item);
+    }
+    return items;
+}
+
+template <class T> QVariantList listToVList(const QVector<T> &items)
+{
+    QVariantList list;
+    list.reserve(items.count());
+    for (const T &item : items)
+        list.append(item.toVMap());
+    return list;
+}
+}
+
+Q_DECLARE_METATYPE(MediaTrackList)
+Q_DECLARE_METATYPE(MediaChapterList)
+
+
 
 
 #endif // HELPERS_H
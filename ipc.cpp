@@ -3,6 +3,7 @@
 #include <QCoreApplication>
 #include <QMetaMethod>
 #include <QJsonDocument>
+#include <QPointer>
 
 #include <mpv/client.h>
 
@@ -35,6 +36,15 @@ static QSet<QString> bannedCommands {
     "suspend", "volume"
 };
 
+// Replies to setting a property or running a command carry only an error
+// code, which is left out when everything went well.
+static QVariant errorOrNothing(QVariant v)
+{
+    if (v.value<MpvErrorCode>().errorcode() == MPV_ERROR_SUCCESS)
+        return QVariant();
+    return v;
+}
+
 
 
 JsonServer::JsonServer(const QString &socketName, QObject *parent) :
@@ -153,6 +163,12 @@ void MpcQtServer::socket_payloadReceived(const QByteArray &payload,
     QVariant value;
     if (ipcCommands.contains(command)) {
         QMetaMethod method = ipcCommands[command];
+        if (method.parameterCount() == 2) {
+            // these answer the socket themselves once mpv has replied
+            method.invoke(this, Q_ARG(QVariantMap, map),
+                                Q_ARG(QLocalSocket*, socket));
+            return;
+        }
         if (ipcCommands[command].returnType() == QMetaType::QVariant)
             method.invoke(this, Q_RETURN_ARG(QVariant, value),
                                 Q_ARG(QVariantMap, map));
@@ -248,36 +264,67 @@ void MpcQtServer::ipc_togglePlayback()
     }
 }
 
-QVariant MpcQtServer::ipc_getMpvProperty(const QVariantMap &map)
+void MpcQtServer::ipc_screenshotBurst(const QVariantMap &map)
 {
-    if (!map.contains("name"))
-        return QVariant::fromValue(MpvErrorCode(-0xdedbeef));
-    return mainWindow->mpvWidget()->getMpvPropertyVariant(map["name"].toString());
+    int count = map.value("count", 5).toInt();
+    int interval = map.value("interval", 200).toInt();
+    if (count > 0 && interval >= 0)
+        emit screenshotBurstRequested(count, interval,
+                                      map.value("subtitles", true).toBool());
 }
 
-QVariant MpcQtServer::ipc_setMpvProperty(const QVariantMap &map)
+void MpcQtServer::ipc_getMpvProperty(const QVariantMap &map,
+                                     QLocalSocket *socket)
 {
-    QString name = map.value("name").toString();
-    if (name.isEmpty() || bannedProperties.contains(name))
-        return QVariant::fromValue(MpvErrorCode(-0xdedbeef));
-
-    return mainWindow->mpvWidget()->blockingSetMpvPropertyVariant(name, map["value"]);
+    if (!map.contains("name")) {
+        socketReturn(socket, true, QVariant::fromValue(MpvErrorCode(-0xdedbeef)));
+        return;
+    }
+    QPointer<QLocalSocket> guard(socket);
+    mainWindow->mpvWidget()->getMpvPropertyVariantAsync(
+                map["name"].toString(), this, [this, guard](QVariant v) {
+        socketReturn(guard, true, v);
+    });
 }
 
-QVariant MpcQtServer::ipc_setMpvOption(const QVariantMap &map)
+void MpcQtServer::ipc_setMpvProperty(const QVariantMap &map,
+                                     QLocalSocket *socket)
 {
     QString name = map.value("name").toString();
-    if (name.isEmpty() || bannedOptions.contains(name))
-        return QVariant::fromValue(MpvErrorCode(-0xdedbeef));
+    if (name.isEmpty() || bannedProperties.contains(name)) {
+        socketReturn(socket, true, QVariant::fromValue(MpvErrorCode(-0xdedbeef)));
+        return;
+    }
+    QPointer<QLocalSocket> guard(socket);
+    mainWindow->mpvWidget()->setMpvPropertyVariantAsync(
+                name, map["value"], this, [this, guard](QVariant v) {
+        socketReturn(guard, true, errorOrNothing(v));
+    });
+}
 
-    return mainWindow->mpvWidget()->blockingSetMpvOptionVariant(name, map["value"]);
+void MpcQtServer::ipc_setMpvOption(const QVariantMap &map,
+                                   QLocalSocket *socket)
+{
+    QString name = map.value("name").toString();
+    if (name.isEmpty() || bannedOptions.contains(name)) {
+        socketReturn(socket, true, QVariant::fromValue(MpvErrorCode(-0xdedbeef)));
+        return;
+    }
+    QPointer<QLocalSocket> guard(socket);
+    mainWindow->mpvWidget()->setMpvOptionVariantAsync(
+                name, map["value"], this, [this, guard](QVariant v) {
+        socketReturn(guard, true, errorOrNothing(v));
+    });
 }
 
-QVariant MpcQtServer::ipc_doMpvCommand(const QVariantMap &map)
+void MpcQtServer::ipc_doMpvCommand(const QVariantMap &map,
+                                   QLocalSocket *socket)
 {
     QString name = map.value("name").toString();
-    if (name.isEmpty() || bannedCommands.contains(name))
-        return QVariant::fromValue(MpvErrorCode(-0xdedbeef));
+    if (name.isEmpty() || bannedCommands.contains(name)) {
+        socketReturn(socket, true, QVariant::fromValue(MpvErrorCode(-0xdedbeef)));
+        return;
+    }
 
     QVariantList command = { name };
     QVariant options = map.value("options");
@@ -288,10 +335,13 @@ QVariant MpcQtServer::ipc_doMpvCommand(const QVariantMap &map)
     else
         command.append(options);
     end:
-    return mainWindow->mpvWidget()->blockingMpvCommand(QVariant(command));
+    QPointer<QLocalSocket> guard(socket);
+    mainWindow->mpvWidget()->mpvCommandAsync(
+                QVariant(command), this, [this, guard](QVariant v) {
+        socketReturn(guard, true, v);
+    });
 }
 
-
 MpvServer::MpvServer(PlaybackManager *playbackManager, MpvWidget *mpvWidget,
                      QObject *parent)
     : JsonServer(QCoreApplication::organizationDomain() + ".mpv", parent),
@@ -420,7 +470,7 @@ void MpvConnection::socket_disconnected()
 void MpvConnection::ctrl_mpvPropertyChanged(QString name, const QVariant &v,
                                             uint64_t userData)
 {
-    if (!userData)
+    if (!userData || MpvController::isInternalId(userData))
         return;
 
     QVariantMap map {
@@ -473,8 +523,9 @@ void MpvConnection::ctrl_unhandledMpvEvent(int eventNumber)
 
 void MpvConnection::command_raw(const QStringList &list, const QVariant &requestId)
 {
-    QVariant v = mpvWidget->controller()->command(list);
-    commandReturn(v.value<MpvErrorCode>().errorcode(), requestId);
+    mpvWidget->mpvCommandAsync(list, this, [this, requestId](QVariant v) {
+        commandReturnVariant(requestId, v);
+    });
 }
 
 void MpvConnection::command_forbidden()
@@ -502,6 +553,16 @@ void MpvConnection::command_get_version(const QVariant &requestId)
                   static_cast<long long>(mpvWidget->controller()->apiVersion()));
 }
 
+void MpvConnection::command_get_wakeup_counts(const QVariant &requestId)
+{
+    MpvController *ctrl = mpvWidget->controller();
+    QVariantMap counts {
+        { "wakeups", ctrl->wakeupCount() },
+        { "drains", ctrl->drainCount() }
+    };
+    commandReturn(MPV_ERROR_SUCCESS, requestId, counts);
+}
+
 void MpvConnection::command_get_property(const QStringList &list,
                                          const QVariant &requestId)
 {
@@ -509,7 +570,10 @@ void MpvConnection::command_get_property(const QStringList &list,
         commandReturn(MPV_ERROR_INVALID_PARAMETER, requestId);
         return;
     }
-    commandReturnVariant(requestId, mpvWidget->controller()->getPropertyVariant(list.at(1)));
+    mpvWidget->getMpvPropertyVariantAsync(list.at(1), this,
+                                          [this, requestId](QVariant v) {
+        commandReturnVariant(requestId, v);
+    });
 }
 
 void MpvConnection::command_get_property_string(const QStringList &list,
@@ -519,31 +583,42 @@ void MpvConnection::command_get_property_string(const QStringList &list,
         commandReturn(MPV_ERROR_INVALID_PARAMETER, requestId);
         return;
     }
-    QString s = mpvWidget->controller()->getPropertyString(list.at(1));
-    if (s.isEmpty())
-        commandReturn(MPV_ERROR_INVALID_PARAMETER, requestId, QVariant(static_cast<char*>(NULL)));
-    else
-        commandReturn(MPV_ERROR_SUCCESS, requestId, s);
+    mpvWidget->getMpvPropertyStringAsync(list.at(1), this,
+                                         [this, requestId](QVariant v) {
+        QString s = v.canConvert<MpvErrorCode>() ? QString() : v.toString();
+        if (s.isEmpty())
+            commandReturn(MPV_ERROR_INVALID_PARAMETER, requestId, QVariant(static_cast<char*>(NULL)));
+        else
+            commandReturn(MPV_ERROR_SUCCESS, requestId, s);
+    });
 }
 
 void MpvConnection::command_set_property(const QVariantList &list,
                                          const QVariant &requestId)
 {
-    if (list.count() != 2
+    if (list.count() != 3
             || !list.at(1).canConvert<QString>()
-            || bannedProperties.contains(list.at(1).toString()))
+            || bannedProperties.contains(list.at(1).toString())) {
         commandReturn(MPV_ERROR_INVALID_PARAMETER, requestId);
-    else
-        commandReturn(mpvWidget->controller()->setPropertyVariant(list.at(1).toString(), list.at(2)), requestId);
+        return;
+    }
+    mpvWidget->setMpvPropertyVariantAsync(list.at(1).toString(), list.at(2),
+                                          this, [this, requestId](QVariant v) {
+        commandReturn(v.value<MpvErrorCode>().errorcode(), requestId);
+    });
 }
 
 void MpvConnection::command_set_property_string(const QStringList &list,
                                                 const QVariant &requestId)
 {
-    if (list.count() != 2)
+    if (list.count() != 3 || bannedProperties.contains(list.at(1))) {
         commandReturn(MPV_ERROR_INVALID_PARAMETER, requestId);
-    else
-        commandReturn(mpvWidget->controller()->setPropertyString(list.at(1), list.at(2)), requestId);
+        return;
+    }
+    mpvWidget->setMpvPropertyVariantAsync(list.at(1), list.at(2),
+                                          this, [this, requestId](QVariant v) {
+        commandReturn(v.value<MpvErrorCode>().errorcode(), requestId);
+    });
 }
 
 void MpvConnection::command_observe_property(const QVariantList &list,
@@ -578,9 +653,38 @@ void MpvConnection::command_unobserve_property(const QVariantList &list,
                                                const QVariant &requestId)
 {
     uint64_t id;
-    if (list.count() != 2 || (id = list.at(1).toInt())==0)
+    if (list.count() != 2 || (id = list.at(1).toInt())==0) {
         commandReturn(MPV_ERROR_INVALID_PARAMETER, requestId);
-    else
-        commandReturn(mpvWidget->controller()->unobservePropertiesById(QSet<uint64_t>() << id), requestId);
+        return;
+    }
+    // the controller's bookkeeping for the id lives on its own thread
+    mpvWidget->unobserveMpvPropertiesAsync(QSet<uint64_t>() << id, this,
+                                           [this, requestId](QVariant v) {
+        commandReturn(v.value<MpvErrorCode>().errorcode(), requestId);
+    });
+}
+
+void MpvConnection::command_set_property_policy(const QVariantList &list,
+                                                const QVariant &requestId)
+{
+    static const QMap<QString,MpvController::ThrottlePolicy> policies = {
+        { "immediate", MpvController::Immediate },
+        { "change", MpvController::OnChange },
+        { "coalesce", MpvController::Coalesce },
+        { "rate", MpvController::MaxRate }
+    };
+    uint64_t id;
+    if (list.count() < 3 || list.count() > 4
+            || (id = list.at(1).toInt())==0
+            || !policies.contains(list.at(2).toString())
+            || (list.count() == 4 && list.at(3).toInt() < 0)) {
+        commandReturn(MPV_ERROR_INVALID_PARAMETER, requestId);
+        return;
+    }
+    mpvWidget->setMpvPropertyPolicyAsync(id, policies.value(list.at(2).toString()),
+                                         list.value(3).toInt(), this,
+                                         [this, requestId](QVariant v) {
+        commandReturn(v.value<MpvErrorCode>().errorcode(), requestId);
+    });
 }
 
@@ -46,6 +46,7 @@ public:
     void fakePayload(const QByteArray &payload);
 
 signals:
+    void screenshotBurstRequested(int count, int interval, bool subtitles);
 
 private:
     void setupIpcCommands();
@@ -66,10 +67,11 @@ private slots:
     void ipc_previous(const QVariantMap &map);
     void ipc_repeat();
     void ipc_togglePlayback();
-    QVariant ipc_getMpvProperty(const QVariantMap &map);
-    QVariant ipc_setMpvProperty(const QVariantMap &map);
-    QVariant ipc_setMpvOption(const QVariantMap &map);
-    QVariant ipc_doMpvCommand(const QVariantMap &map);
+    void ipc_screenshotBurst(const QVariantMap &map);
+    void ipc_getMpvProperty(const QVariantMap &map, QLocalSocket *socket);
+    void ipc_setMpvProperty(const QVariantMap &map, QLocalSocket *socket);
+    void ipc_setMpvOption(const QVariantMap &map, QLocalSocket *socket);
+    void ipc_doMpvCommand(const QVariantMap &map, QLocalSocket *socket);
 
 private:
     PlaybackManager *playbackManager;
@@ -127,6 +129,7 @@ private slots:
     void command_client_name(const QVariant &requestId);
     void command_get_time_us(const QVariant &requestId);
     void command_get_version(const QVariant &requestId);
+    void command_get_wakeup_counts(const QVariant &requestId);
     void command_get_property(const QStringList &list, const QVariant &requestId);
     void command_get_property_string(const QStringList &list, const QVariant &requestId);
     void command_set_property(const QVariantList &list, const QVariant &requestId);
@@ -134,6 +137,7 @@ private slots:
     void command_observe_property(const QVariantList &list, const QVariant &requestId);
     void command_observe_property_string(const QVariantList &list, const QVariant &requestId);
     void command_unobserve_property(const QVariantList &list, const QVariant &requestId);
+    void command_set_property_policy(const QVariantList &list, const QVariant &requestId);
 
 private:
     QLocalSocket *socket;
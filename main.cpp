@@ -3,18 +3,69 @@
 #include <QApplication>
 #include <QDesktopWidget>
 #include <QLocalSocket>
+#include <QFile>
 #include <QFileDialog>
 #include <QDir>
+#include <QElapsedTimer>
 #include <QStandardPaths>
 #include <QUuid>
 #include <QJsonDocument>
+#include <QTextStream>
+#include <QThreadPool>
 #include <QTimer>
+#include <QtConcurrent>
 #include "main.h"
 #include "storage.h"
 #include "mainwindow.h"
 #include "manager.h"
 #include "settingswindow.h"
 #include "mpvwidget.h"
+#include "playlist.h"
+
+// What was learnt by probing is written out this often, as well as on exit.
+static const int mediaInfoSaveInterval = 5 * 60 * 1000;
+
+static int benchmarkSearch()
+{
+    // Filters a large made-up playlist with the pool limited to each thread
+    // count in turn, and reports how many items were looked at per second.
+    static const int itemCount = 1000000;
+    static const int repeats = 5;
+    QList<QSharedPointer<Item>> items;
+    items.reserve(itemCount);
+    for (int i = 0; i < itemCount; i++) {
+        QUrl url = QUrl::fromLocalFile(
+                    QString("/media/music/Artist %1/Album %2/%3 - Track.flac")
+                    .arg(i % 997).arg(i % 89).arg(i));
+        QVariantMap metadata({ { "title", QString("Track %1").arg(i) },
+                               { "artist", QString("Artist %1").arg(i % 997) } });
+        items.append(QSharedPointer<Item>(new Item(QUuid::createUuid(), url,
+                                                   metadata)));
+    }
+    QSharedPointer<Playlist> list(new Playlist("benchmark"));
+    list->addItems(QUuid(), items);
+
+    PlaylistSearcher searcher;
+    QTextStream out(stdout);
+    for (int threads : { 1, 2, 4, 8 }) {
+        QThreadPool::globalInstance()->setMaxThreadCount(threads);
+        qint64 elapsed = 0;
+        for (int i = 0; i < repeats; i++) {
+            // Start from the whole list each time, rather than refining
+            searcher.clearPlaylistFilter(list);
+            QElapsedTimer timer;
+            timer.start();
+            searcher.filterPlaylist(list, "artist 42 track",
+                                    searcher.nextGeneration());
+            elapsed += timer.nsecsElapsed();
+        }
+        out << threads << " threads: "
+            << qint64(1e9 * itemCount * repeats / qMax(elapsed, qint64(1)))
+            << " items/s\n";
+        out.flush();
+    }
+    return 0;
+}
 
 int main(int argc, char *argv[])
 {
@@ -29,6 +80,14 @@ int main(int argc, char *argv[])
     // Register the error code type so that signals/slots will work with it
     qRegisterMetaType<MpvErrorCode>("MpvErrorCode");
     qRegisterMetaType<uint64_t>("uint64_t");
+    qRegisterMetaType<QSet<uint64_t>>("QSet<uint64_t>");
+    qRegisterMetaType<MpvCallback*>("MpvCallback*");
+    qRegisterMetaType<MediaTrackList>("MediaTrackList");
+    qRegisterMetaType<MediaChapterList>("MediaChapterList");
+    qRegisterMetaType<QList<QSharedPointer<Item>>>("QList<QSharedPointer<Item>>");
+
+    if (a.arguments().contains("--bench-search"))
+        return benchmarkSearch();
 
     Flow f;
     if (!f.hasPrevious())
@@ -39,7 +98,10 @@ int main(int argc, char *argv[])
 
 Flow::Flow(QObject *owner) :
     QObject(owner), server(NULL), mpvServer(NULL), mainWindow(NULL),
-    playbackManager(NULL), settingsWindow(NULL)
+    playbackManager(NULL), settingsWindow(NULL), playlistJournal(NULL),
+    importThread(NULL), playlistImporter(NULL), metadataProber(NULL),
+    screenshotter(NULL), thumbnailer(NULL), mediaInfoTimer(NULL),
+    playlistsLoaded(false)
 {
     mainWindow = new MainWindow();
     playbackManager = new PlaybackManager(this);
@@ -57,6 +119,8 @@ Flow::Flow(QObject *owner) :
     // mainwindow -> manager
     connect(mainWindow, &MainWindow::severalFilesOpened,
             playbackManager, &PlaybackManager::openSeveralFiles);
+    connect(mainWindow, &MainWindow::severalFilesAppended,
+            playbackManager, &PlaybackManager::appendSeveralFiles);
     connect(mainWindow, &MainWindow::fileOpened,
             playbackManager, &PlaybackManager::openFile);
     connect(mainWindow, &MainWindow::dvdbdOpened,
@@ -200,16 +264,8 @@ Flow::Flow(QObject *owner) :
             mpvw, &MpvWidget::setScreenshotFormat);
     connect(settingsWindow, &SettingsWindow::screenshotJpegQuality,
             mpvw, &MpvWidget::setScreenshotJpegQuality);
-    connect(settingsWindow, &SettingsWindow::screenshotJpegSmooth,
-            mpvw, &MpvWidget::setScreenshotJpegSmooth);
-    connect(settingsWindow, &SettingsWindow::screenshotJpegSourceChroma,
-            mpvw, &MpvWidget::setScreenshotJpegSourceChroma);
     connect(settingsWindow, &SettingsWindow::screenshotPngCompression,
             mpvw, &MpvWidget::setScreenshotPngCompression);
-    connect(settingsWindow, &SettingsWindow::screenshotPngFilter,
-            mpvw, &MpvWidget::setScreenshotPngFilter);
-    connect(settingsWindow, &SettingsWindow::screenshotPngColorspace,
-            mpvw, &MpvWidget::setScreenshotPngColorspace);
     connect(settingsWindow, &SettingsWindow::clientDebuggingMessages,
             mpvw, &MpvWidget::setClientDebuggingMessages);
     connect(settingsWindow, &SettingsWindow::mpvLogLevel,
@@ -273,6 +329,78 @@ Flow::Flow(QObject *owner) :
     connect(mainWindow->playlistWindow(), &PlaylistWindow::exportPlaylist,
             this, &Flow::exportPlaylist);
 
+    // this -> importer -> playlistwindow
+    importThread = new QThread(this);
+    playlistImporter = new PlaylistImporter();
+    playlistImporter->moveToThread(importThread);
+    connect(importThread, &QThread::finished,
+            playlistImporter, &QObject::deleteLater);
+    connect(this, &Flow::playlistImportRequested,
+            playlistImporter, &PlaylistImporter::readPlaylist,
+            Qt::QueuedConnection);
+    connect(playlistImporter, &PlaylistImporter::itemsRead,
+            mainWindow->playlistWindow(), &PlaylistWindow::addImportedItems,
+            Qt::QueuedConnection);
+    connect(playlistImporter, &PlaylistImporter::progress,
+            mainWindow->playlistWindow(), &PlaylistWindow::setImportProgress,
+            Qt::QueuedConnection);
+    connect(playlistImporter, &PlaylistImporter::finished,
+            mainWindow->playlistWindow(), &PlaylistWindow::finishImport,
+            Qt::QueuedConnection);
+    importThread->start();
+
+    // playlists -> this.journal
+    playlistJournal = new PlaylistJournal(&storage, this);
+    auto playlists = PlaylistCollection::getSingleton();
+    connect(playlists.data(), &PlaylistCollection::playlistAdded,
+            playlistJournal, &PlaylistJournal::playlistAdded);
+    connect(playlists.data(), &PlaylistCollection::playlistRemoved,
+            playlistJournal, &PlaylistJournal::playlistRemoved);
+    connect(playlists.data(), &PlaylistCollection::itemsInserted,
+            playlistJournal, &PlaylistJournal::itemsInserted);
+    connect(playlists.data(), &PlaylistCollection::itemsRemoved,
+            playlistJournal, &PlaylistJournal::itemsRemoved);
+    connect(playlists.data(), &PlaylistCollection::itemChanged,
+            playlistJournal, &PlaylistJournal::itemChanged);
+    connect(playlists.data(), &PlaylistCollection::playlistCleared,
+            playlistJournal, &PlaylistJournal::playlistCleared);
+    connect(playlists.data(), &PlaylistCollection::titleChanged,
+            playlistJournal, &PlaylistJournal::titleChanged);
+    connect(playlistJournal, &PlaylistJournal::compactionDue,
+            this, &Flow::playlistjournal_compactionDue);
+
+    // playlists -> this.prober -> playlistwindow
+    MediaInfoCache::getSingleton()->load(storage.filePath("mediainfo.bin"));
+    metadataProber = new MetadataProber(this);
+    connect(playlists.data(), &PlaylistCollection::playlistAdded,
+            metadataProber, &MetadataProber::playlistAdded);
+    connect(playlists.data(), &PlaylistCollection::itemsInserted,
+            metadataProber, &MetadataProber::itemsInserted);
+    connect(metadataProber, &MetadataProber::metadataProbed,
+            mainWindow->playlistWindow(), &PlaylistWindow::setMetadata);
+    mediaInfoTimer = new QTimer(this);
+    mediaInfoTimer->setInterval(mediaInfoSaveInterval);
+    connect(mediaInfoTimer, &QTimer::timeout,
+            this, &Flow::mediainfotimer_timeout);
+    mediaInfoTimer->start();
+
+    // settings -> this.screenshotter -> this
+    screenshotter = new Screenshotter(mainWindow->mpvWidget(), this);
+    connect(settingsWindow, &SettingsWindow::screenshotFormat,
+            screenshotter, &Screenshotter::setFormat);
+    connect(settingsWindow, &SettingsWindow::screenshotJpegQuality,
+            screenshotter, &Screenshotter::setJpegQuality);
+    connect(settingsWindow, &SettingsWindow::screenshotPngCompression,
+            screenshotter, &Screenshotter::setPngCompression);
+    connect(screenshotter, &Screenshotter::imageFailed,
+            this, &Flow::screenshotter_imageFailed);
+    connect(server, &MpcQtServer::screenshotBurstRequested,
+            this, &Flow::server_screenshotBurstRequested);
+
+    // manager -> this.thumbnailer -> mainwindow
+    thumbnailer = new Thumbnailer(this);
+    mainWindow->setThumbnailer(thumbnailer);
+
     // this -> mainwindow
     connect(this, &Flow::recentFilesChanged,
             mainWindow, &MainWindow::setRecentDocuments);
@@ -287,7 +415,6 @@ Flow::Flow(QObject *owner) :
     mainWindow->setRecentDocuments(recentFiles);
     settings = storage.readVMap("settings");
     keyMap = storage.readVMap("keys");
-    settingsWindow->setAudioDevices(mpvw->audioDevices());
     settingsWindow->takeSettings(settings);
     settingsWindow->setMouseMapDefaults(mainWindow->mouseMapDefaults());
     settingsWindow->takeKeyMap(keyMap);
@@ -311,6 +438,21 @@ Flow::Flow(QObject *owner) :
 
 Flow::~Flow()
 {
+    if (importThread) {
+        importThread->requestInterruption();
+        importThread->quit();
+        importThread->wait();
+    }
+    if (metadataProber) {
+        delete metadataProber;
+        metadataProber = NULL;
+    }
+    if (screenshotter) {
+        delete screenshotter;
+        screenshotter = NULL;
+    }
+    mediaInfoSaving.waitForFinished();
+    MediaInfoCache::getSingleton()->save(storage.filePath("mediainfo.bin"));
     if (server) {
         delete server;
         server = NULL;
@@ -320,10 +462,15 @@ Flow::~Flow()
         mpvServer = NULL;
     }
     if (mainWindow) {
-        storage.writeVList("playlists", mainWindow->playlistWindow()->tabsToVList());
+        if (playlistJournal)
+            playlistJournal->finish(mainWindow->playlistWindow()->tabsToPlaylists());
         delete mainWindow;
         mainWindow = NULL;
     }
+    if (thumbnailer) {
+        delete thumbnailer;
+        thumbnailer = NULL;
+    }
     if (playbackManager) {
         delete playbackManager;
         playbackManager = NULL;
@@ -336,7 +483,37 @@ Flow::~Flow()
 
 int Flow::run()
 {
-    mainWindow->playlistWindow()->tabsFromVList(storage.readVList("playlists"));
+    QList<SavedPlaylist> playlists;
+    quint64 folded = 0;
+    bool hasBinary = QFile::exists(storage.filePath("playlists.bin"));
+    playlistsLoaded = true;
+    if (storage.readPlaylists("playlists", playlists, folded)) {
+        playlistJournal->replay(playlists, folded);
+        mainWindow->playlistWindow()->tabsFromPlaylists(playlists);
+    } else if (!hasBinary && !playlistJournal->exists()) {
+        // Playlists from older versions are kept in json, and are moved over
+        // to the binary file the first time we see them.
+        mainWindow->playlistWindow()->tabsFromVList(storage.readVList("playlists"));
+        storage.writePlaylists("playlists", Storage::imagesOf(
+                                   mainWindow->playlistWindow()->tabsToPlaylists()));
+    } else {
+        // A damaged file is kept for the user rather than written over, and
+        // whatever the journal holds is still recovered.  Nothing is folded
+        // into a new file until playlists have been loaded properly.
+        if (hasBinary) {
+            playlistsLoaded = false;
+            QString aside = storage.setAside("playlists.bin");
+            mainWindow->mpvWidget()->showMessage(
+                        tr("Saved playlists could not be read, and were kept as %1")
+                        .arg(aside.isEmpty() ? storage.filePath("playlists.bin")
+                                             : aside));
+        }
+        playlistJournal->replay(playlists);
+        mainWindow->playlistWindow()->tabsFromPlaylists(playlists);
+    }
+    // Start recording changes, and fold in whatever was replayed
+    playlistJournal->start();
+    playlistjournal_compactionDue();
     QTimer::singleShot(50, this, [this]() {
         // wait for the internal geometry to update, then perform a resize
         restoreWindows(storage.readVMap("geometry"));
@@ -384,6 +561,15 @@ QString Flow::pictureTemplate(Helpers::DisabledTrack tracks, Helpers::Subtitles
     return filePath + "/" + fileName + "." + screenshotFormat;
 }
 
+Screenshotter::NameSource Flow::pictureNameSource(bool subs) const
+{
+    return [this, subs]() {
+        return pictureTemplate(Helpers::DisabledAudio,
+                               subs ? Helpers::SubtitlesPresent
+                                    : Helpers::SubtitlesDisabled);
+    };
+}
+
 QVariantList Flow::recentToVList() const
 {
     QVariantList l;
@@ -497,37 +683,24 @@ void Flow::mainwindow_recentClear()
 
 void Flow::mainwindow_takeImage(bool subs)
 {
-    QString fmt;
-#ifdef Q_OS_WINDOWS
-    fmt = "C:\\WINDOWS\\TEMP\\mpc-qt_%1";
-#else
-    fmt = "/dev/shm/mpc-qt_%1";
-#endif
-    QString tempFile = QString(fmt).arg(QUuid::createUuid().toString());
-    mainWindow->mpvWidget()->screenshot(tempFile, subs);
-    tempFile += "." + screenshotFormat;
-
-    QString fileName = pictureTemplate(Helpers::DisabledAudio,
-                                       subs ? Helpers::SubtitlesPresent
-                                            : Helpers::SubtitlesDisabled);
-    QString picFile;
-    picFile = QFileDialog::getSaveFileName(this->mainWindow, tr("Save Image"),
-                                           fileName);
-    if (picFile.isEmpty()) {
-        QFile(tempFile).remove();
-        return;
-    }
-    QFileInfo qfi(picFile);
-    QString dest = qfi.absolutePath() + "/" + qfi.completeBaseName();
-    QFile(tempFile).copy(dest);
+    // The frame is held in memory while the user picks where it goes.
+    auto name = pictureNameSource(subs);
+    screenshotter->grab(subs, [this, name](QImage image) {
+        if (image.isNull()) {
+            screenshotter_imageFailed(name());
+            return;
+        }
+        QString picFile;
+        picFile = QFileDialog::getSaveFileName(this->mainWindow,
+                                               tr("Save Image"), name());
+        if (!picFile.isEmpty())
+            screenshotter->save(image, picFile);
+    });
 }
 
 void Flow::mainwindow_takeImageAutomatically(bool subs)
 {
-    QString fileName = pictureTemplate(Helpers::DisabledAudio,
-                                       subs ? Helpers::SubtitlesPresent
-                                            : Helpers::SubtitlesDisabled);
-    mainWindow->mpvWidget()->screenshot(fileName, subs);
+    screenshotter->capture(pictureNameSource(subs), subs);
 }
 
 void Flow::mainwindow_optionsOpenRequested()
@@ -549,6 +722,17 @@ void Flow::manager_nowPlayingChanged(QUrl url, QUuid listUuid, QUuid itemUuid)
         recentFiles.removeLast();
 
     emit recentFilesChanged(recentFiles);
+    thumbnailer->setFile(url);
+}
+
+void Flow::server_screenshotBurstRequested(int count, int interval, bool subs)
+{
+    screenshotter->burst(pictureNameSource(subs), subs, count, interval);
+}
+
+void Flow::screenshotter_imageFailed(QString fileName)
+{
+    mainWindow->mpvWidget()->showMessage(tr("Could not save %1").arg(fileName));
 }
 
 void Flow::settingswindow_settingsData(const QVariantMap &settings)
@@ -591,13 +775,33 @@ void Flow::settingswindow_screenshotFormat(const QString &fmt)
     this->screenshotFormat = fmt;
 }
 
+void Flow::playlistjournal_compactionDue()
+{
+    if (!playlistsLoaded)
+        return;
+    playlistJournal->compact(mainWindow->playlistWindow()->tabsToPlaylists());
+}
+
+void Flow::mediainfotimer_timeout()
+{
+    if (mediaInfoSaving.isRunning())
+        return;
+    QString fname = storage.filePath("mediainfo.bin");
+    mediaInfoSaving = QtConcurrent::run([fname]() {
+        MediaInfoCache::getSingleton()->save(fname);
+    });
+}
+
 void Flow::importPlaylist(QString fname)
 {
-    emit mainWindow->playlistWindow()->addSimplePlaylist(storage.readM3U(fname));
+    emit playlistImportRequested(fname,
+                                 mainWindow->playlistWindow()->newImportedPlaylist());
 }
 
-void Flow::exportPlaylist(QString fname, QStringList items)
+void Flow::exportPlaylist(QString fname, QUuid playlist)
 {
-    storage.writeM3U(fname, items);
+    auto pl = PlaylistCollection::getSingleton()->playlistOf(playlist);
+    if (pl)
+        storage.writeM3U(fname, pl);
 }
 
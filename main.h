@@ -1,13 +1,18 @@
 #ifndef MAIN_H
 #define MAIN_H
+#include <QFuture>
 #include <QHash>
 #include <QMetaMethod>
+#include <QThread>
 #include "ipc.h"
 #include "helpers.h"
 #include "mainwindow.h"
 #include "manager.h"
 #include "storage.h"
+#include "prober.h"
+#include "screenshotter.h"
 #include "settingswindow.h"
+#include "thumbnailer.h"
 
 // a simple class to control program exection and own application objects
 class Flow : public QObject {
@@ -21,11 +26,13 @@ public:
 
 signals:
     void recentFilesChanged(QList<TrackInfo> urls);
+    void playlistImportRequested(QString fname, QUuid playlist);
     void windowsRestored();
 
 private:
     QByteArray makePayload() const;
     QString pictureTemplate(Helpers::DisabledTrack tracks, Helpers::Subtitles subs) const;
+    Screenshotter::NameSource pictureNameSource(bool subs) const;
     QVariantList recentToVList() const;
     void recentFromVList(const QVariantList &list);
     QVariantMap saveWindows();
@@ -41,6 +48,8 @@ private slots:
     void mainwindow_takeImageAutomatically(bool subs);
     void mainwindow_optionsOpenRequested();
     void manager_nowPlayingChanged(QUrl url, QUuid listUuid, QUuid itemUuid);
+    void server_screenshotBurstRequested(int count, int interval, bool subs);
+    void screenshotter_imageFailed(QString fileName);
     void settingswindow_settingsData(const QVariantMap &settings);
     void settingswindow_rememberWindowGeometry(bool yes);
     void settingswindow_keymapData(const QVariantMap &keyMap);
@@ -49,8 +58,10 @@ private slots:
     void settingswindow_screenshotTemplate(const QString &fmt);
     void settingswindow_encodeTemplate(const QString &fmt);
     void settingswindow_screenshotFormat(const QString &fmt);
+    void playlistjournal_compactionDue();
+    void mediainfotimer_timeout();
     void importPlaylist(QString fname);
-    void exportPlaylist(QString fname, QStringList items);
+    void exportPlaylist(QString fname, QUuid playlist);
 
 private:
     MpcQtServer *server;
@@ -59,6 +70,15 @@ private:
     PlaybackManager *playbackManager;
     SettingsWindow *settingsWindow;
     Storage storage;
+    PlaylistJournal *playlistJournal;
+    QThread *importThread;
+    PlaylistImporter *playlistImporter;
+    MetadataProber *metadataProber;
+    Screenshotter *screenshotter;
+    Thumbnailer *thumbnailer;
+    QTimer *mediaInfoTimer;
+    QFuture<void> mediaInfoSaving;
+    bool playlistsLoaded;
     QVariantMap settings;
     QVariantMap keyMap;
     QList<TrackInfo> recentFiles;
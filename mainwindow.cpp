@@ -32,6 +32,7 @@ MainWindow::MainWindow(QWidget *parent) :
     bottomAreaHeight = 0;
     bottomAreaHideTime = 0;
     timeTooltipAbove = false;
+    thumbnailer = NULL;
     isPlaying = false;
     sizeFactor_ = 1;
     fitFactor_ = 0.75;
@@ -57,6 +58,7 @@ MainWindow::MainWindow(QWidget *parent) :
     setupSizing();
     setupBottomArea();
     setupHideTimer();
+    setupDirectoryScanner();
 
     mpvw->installEventFilter(this);
     playlistWindow_->installEventFilter(this);
@@ -161,6 +163,11 @@ void MainWindow::setState(const QVariantMap &map)
 #undef UNWRAP
 }
 
+void MainWindow::setThumbnailer(Thumbnailer *thumbnailer)
+{
+    this->thumbnailer = thumbnailer;
+}
+
 void MainWindow::resizeEvent(QResizeEvent *event)
 {
     Q_UNUSED(event);
@@ -334,6 +341,9 @@ void MainWindow::setupPositionSlider()
             this, &MainWindow::position_sliderMoved);
     connect(positionSlider_, &QMediaSlider::hoverValue,
             this, &MainWindow::position_hoverValue);
+    connect(positionSlider_, &QMediaSlider::hoverEnd,
+            this, &MainWindow::position_hoverEnd);
+    seekPreview = new SeekPreview(this);
 }
 
 void MainWindow::setupVolumeSlider()
@@ -414,6 +424,13 @@ void MainWindow::setupHideTimer()
             this, &MainWindow::hideTimer_timeout);
 }
 
+void MainWindow::setupDirectoryScanner()
+{
+    directoryScanner = new DirectoryScanner(this);
+    connect(directoryScanner, &DirectoryScanner::filesFound,
+            this, &MainWindow::directoryScanner_filesFound);
+}
+
 void MainWindow::connectActionsToSlots()
 {
     connect(ui->actionHelpAboutQt, &QAction::triggered,
@@ -906,6 +923,8 @@ void MainWindow::setTimeTooltip(bool shown, bool above)
 {
     timeTooltipShown = shown;
     timeTooltipAbove = above;
+    if (!shown)
+        seekPreview->hide();
 }
 
 void MainWindow::setFullscreenHidePanels(bool hidden)
@@ -1103,12 +1122,8 @@ void MainWindow::on_actionFileOpenDirectory_triggered()
         return;
     lastDir = url;
 
-    QDir dir(url.toLocalFile());
-    QList<QUrl> list;
-    QFileInfoList f = dir.entryInfoList(QDir::NoDotAndDotDot | QDir::Files);
-    for(auto file : f)
-        list.append(QUrl::fromLocalFile(file.absoluteFilePath()));
-    emit severalFilesOpened(list);
+    scanPlaylist = playlistWindow_->currentPlaylistUuid();
+    directoryScanner->scan(url.toLocalFile());
 }
 
 void MainWindow::on_actionFileOpenNetworkStream_triggered()
@@ -1569,10 +1584,22 @@ void MainWindow::position_hoverValue(double value, QString text, double x)
         text = "<unknown>";
 
     QString t = QString("%1 - %2").arg(Helpers::toDateFormat(value)).arg(text);
+    QImage thumbnail = thumbnailer ? thumbnailer->thumbnailAt(value) : QImage();
+    if (!thumbnail.isNull()) {
+        QToolTip::hideText();
+        QPoint where = positionSlider_->mapToGlobal(
+                    QPoint(x, timeTooltipAbove ? 0 : positionSlider_->height()));
+        seekPreview->showPreview(thumbnail, t, where, timeTooltipAbove);
+        return;
+    }
+    seekPreview->hide();
     QPoint where = positionSlider_->mapToGlobal(QPoint(x, timeTooltipAbove ? -40 : 0));
     QToolTip::showText(where, t, positionSlider_);
+}
 
-    //FIXME: use a widget not the system tooltip?
+void MainWindow::position_hoverEnd()
+{
+    seekPreview->hide();
 }
 
 void MainWindow::on_play_clicked()
@@ -1609,6 +1636,17 @@ void MainWindow::hideTimer_timeout()
         ui->bottomArea->hide();
 }
 
+void MainWindow::directoryScanner_filesFound(QList<QUrl> files, bool first)
+{
+    // Only the first batch may start playback; the rest of the tree is
+    // appended behind it as it is found.  Batches go to the playlist that
+    // was current when the scan began, whichever one is being looked at.
+    if (first && playlistWindow_->currentPlaylistUuid() == scanPlaylist)
+        emit severalFilesOpened(files);
+    else
+        emit severalFilesAppended(scanPlaylist, files);
+}
+
 void MainWindow::sendUpdateSize()
 {
     updateSize();
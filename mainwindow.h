@@ -10,6 +10,7 @@
 #include "qdrawnstatus.h"
 #include "manager.h"
 #include "playlistwindow.h"
+#include "thumbnailer.h"
 
 namespace Ui {
 class MainWindow;
@@ -35,6 +36,7 @@ public:
     QVariantMap mouseMapDefaults();
     QVariantMap state();
     void setState(const QVariantMap &map);
+    void setThumbnailer(Thumbnailer *thumbnailer);
 
 protected:
     void resizeEvent(QResizeEvent *event);
@@ -72,6 +74,7 @@ private:
     void setupSizing();
     void setupBottomArea();
     void setupHideTimer();
+    void setupDirectoryScanner();
     void connectActionsToSlots();
     void connectButtonsToActions();
     void connectPlaylistWindowToActions();
@@ -92,6 +95,7 @@ signals:
     void applicationShouldQuit();
     void fileOpened(QUrl what);
     void severalFilesOpened(QList<QUrl> what, bool important = false);
+    void severalFilesAppended(QUuid list, QList<QUrl> what);
     void dvdbdOpened(QUrl what);
     void streamOpened(QUrl what);
     void recentOpened(TrackInfo info);
@@ -233,10 +237,12 @@ private slots:
 
     void position_sliderMoved(int position);
     void position_hoverValue(double value, QString text, double x);
+    void position_hoverEnd();
     void on_play_clicked();
     void volume_sliderMoved(double position);
     void playlistWindow_windowDocked();
     void hideTimer_timeout();
+    void directoryScanner_filesFound(QList<QUrl> files, bool first);
 
     void sendUpdateSize();
 
@@ -248,8 +254,12 @@ private:
     QVolumeSlider *volumeSlider_;
     QStatusTime *timePosition;
     QStatusTime *timeDuration;
+    SeekPreview *seekPreview;
+    Thumbnailer *thumbnailer;
     PlaylistWindow *playlistWindow_;
     QTimer hideTimer;
+    DirectoryScanner *directoryScanner;
+    QUuid scanPlaylist;
 
     DecorationState decorationState_;
     bool fullscreenMaximized;
@@ -1,17 +1,35 @@
 #include <QDebug>
+#include <QTimer>
 #include <cmath>
 #include "manager.h"
 #include "mainwindow.h"
 #include "mpvwidget.h"
 #include "helpers.h"
+#include "playlist.h"
 
 using namespace Helpers;
 
 
 PlaybackManager::PlaybackManager(QObject *parent) :
     QObject(parent), mpvSpeed(1.0), playbackState_(StoppedState),
-    playbackPlayTimes(1)
-{
+    playbackPlayTimes(1), preloadRevision(-1)
+{
+    // Keep the preloaded file in step with the list and the queue as they
+    // change, whether or not anything is playing at the time.  Changes to
+    // both are caught up with together, once the event loop comes around.
+    preloadTimer = new QTimer(this);
+    preloadTimer->setSingleShot(true);
+    preloadTimer->setInterval(0);
+    connect(preloadTimer, &QTimer::timeout,
+            this, &PlaybackManager::preloadTimer_timeout);
+
+    auto collection = PlaylistCollection::getSingleton();
+    connect(collection.data(), &PlaylistCollection::playlistRevised,
+            this, &PlaybackManager::playlists_playlistRevised,
+            Qt::QueuedConnection);
+    connect(collection->queuePlaylist().data(), &Playlist::revised,
+            this, &PlaybackManager::playlists_playlistRevised,
+            Qt::QueuedConnection);
 }
 
 void PlaybackManager::setMpvWidget(MpvWidget *mpvWidget, bool makeConnections)
@@ -82,6 +100,12 @@ PlaybackManager::PlaybackState PlaybackManager::playbackState()
     return playbackState_;
 }
 
+static QString mpvFilename(const QUrl &url)
+{
+    return url.isLocalFile() ? url.toLocalFile()
+                             : url.fromPercentEncoding(url.toEncoded());
+}
+
 void PlaybackManager::startPlayWithUuid(QUrl what, QUuid playlistUuid,
                                         QUuid itemUuid, bool isRepeating)
 {
@@ -89,9 +113,16 @@ void PlaybackManager::startPlayWithUuid(QUrl what, QUuid playlistUuid,
         return;
     emit stateChanged(playbackState_ = WaitingState);
 
+    mpvWidget_->fileOpen(mpvFilename(what));
+    forgetPreload();
+    takeNowPlaying(what, playlistUuid, itemUuid, isRepeating);
+}
+
+void PlaybackManager::takeNowPlaying(QUrl what, QUuid playlistUuid,
+                                     QUuid itemUuid, bool isRepeating)
+{
     nowPlaying_ = what;
-    mpvWidget_->fileOpen(what.isLocalFile() ? what.toLocalFile()
-                                            : what.fromPercentEncoding(what.toEncoded()));
+    restoreMediaInfo(what);
     this->nowPlayingList = playlistUuid;
     this->nowPlayingItem = itemUuid;
 
@@ -103,6 +134,72 @@ void PlaybackManager::startPlayWithUuid(QUrl what, QUuid playlistUuid,
         playlistWindow_->setExtraPlayTimes(playlistUuid, itemUuid, playbackPlayTimes - 1);
     }
     emit nowPlayingChanged(nowPlaying_, nowPlayingList, nowPlayingItem);
+    updatePreload();
+}
+
+void PlaybackManager::updatePreload()
+{
+    // Work out what mpvw_playbackIdling would play next, without taking
+    // anything from the queue, and have mpv load it ahead of time.
+    QPair<QUuid, QUuid> next;
+    int extraTimes = playlistWindow_->extraPlayTimes(nowPlayingList,
+                                                     nowPlayingItem);
+    if (!nowPlayingItem.isNull()) {
+        if (playbackPlayTimes < 1 || extraTimes > 0)
+            next = { nowPlayingList, nowPlayingItem };
+        else
+            next = playlistWindow_->peekItemAfter(nowPlayingList,
+                                                  nowPlayingItem);
+    }
+    preloadRevision = playlistWindow_->playOrderRevision(nowPlayingList);
+
+    QUrl url = playlistWindow_->getUrlOf(next.first, next.second);
+    if (url.isEmpty())
+        next = QPair<QUuid, QUuid>();
+    if (next == preloaded && url == preloadedUrl)
+        return;
+    preloaded = next;
+    preloadedUrl = url;
+    mpvWidget_->setPreloadedFile(url.isEmpty() ? QString() : mpvFilename(url));
+}
+
+void PlaybackManager::forgetPreload()
+{
+    preloaded = QPair<QUuid, QUuid>();
+    preloadedUrl.clear();
+    preloadRevision = -1;
+}
+
+void PlaybackManager::advanceToPreloaded()
+{
+    // mpv has moved on to the preloaded file by itself, so do the same
+    // bookkeeping that finishing the file and starting the next would.
+    QPair<QUuid, QUuid> expected = preloaded;
+    QUrl url = preloadedUrl;
+    forgetPreload();
+    mpvWidget_->setPreloadedFile(QString());
+
+    int extraTimes = playlistWindow_->extraPlayTimes(nowPlayingList, nowPlayingItem);
+    playlistWindow_->setExtraPlayTimes(nowPlayingList, nowPlayingItem, extraTimes - 1);
+    bool isRepeating = playbackPlayTimes < 1 || extraTimes > 0;
+    QPair<QUuid, QUuid> next;
+    if (isRepeating)
+        next = { nowPlayingList, nowPlayingItem };
+    else
+        next = playlistWindow_->getItemAfter(nowPlayingList, nowPlayingItem);
+
+    if (next != expected) {
+        // The order changed in a way we missed, so play what should have
+        // been played instead.
+        QUrl nextUrl = playlistWindow_->getUrlOf(next.first, next.second);
+        if (nextUrl.isEmpty()) {
+            stopPlayer();
+            return;
+        }
+        startPlayWithUuid(nextUrl, next.first, next.second, isRepeating);
+        return;
+    }
+    takeNowPlaying(url, next.first, next.second, isRepeating);
 }
 
 void PlaybackManager::selectDesiredTracks()
@@ -141,6 +238,106 @@ void PlaybackManager::selectDesiredTracks()
         subtitleListSelected.clear();
 }
 
+void PlaybackManager::updateTracks(const MediaTrackList &tracks,
+                                   bool selectTracks)
+{
+    videoList.clear();
+    audioList.clear();
+    subtitleList.clear();
+    QPair<int64_t,QString> item;
+
+    for (const MediaTrack &track : tracks) {
+        item.first = track.id;
+        item.second = track.displayString();
+        switch (track.type) {
+        case MediaTrack::VideoTrack:
+            videoList.append(item);
+            break;
+        case MediaTrack::AudioTrack:
+            audioList.append(item);
+            break;
+        case MediaTrack::SubtitleTrack:
+            subtitleList.append(item);
+            break;
+        default:
+            break;
+        }
+    }
+    emit videoTracksAvailable(videoList);
+    emit audioTracksAvailable(audioList);
+    emit subtitleTracksAvailable(subtitleList);
+
+    if (selectTracks)
+        selectDesiredTracks();
+
+    emit hasNoVideo(videoList.empty());
+    emit hasNoAudio(audioList.empty());
+    emit hasNoSubtitles(subtitleList.empty());
+}
+
+void PlaybackManager::updateChapters(const MediaChapterList &chapters)
+{
+    QList<QPair<double,QString>> list;
+    list.reserve(chapters.count());
+    for (const MediaChapter &chapter : chapters) {
+        QString text = QString("[%1] - %2").arg(toDateFormat(chapter.time),
+                                                chapter.title);
+        list.append(QPair<double,QString>(chapter.time, text));
+    }
+    numChapters = list.count();
+    emit chaptersAvailable(list);
+}
+
+void PlaybackManager::restoreMediaInfo(const QUrl &what)
+{
+    // Fill in the menus from when this file was last seen, so that they can
+    // be used while mpv is still opening it.  Whatever mpv then reports
+    // replaces them, and is remembered for next time.
+    nowPlayingPath.clear();
+    nowPlayingInfo = MediaInfo();
+    if (!what.isLocalFile())
+        return;
+    QString path = what.toLocalFile();
+    if (!MediaInfoCache::identify(path, nowPlayingInfo.size,
+                                  nowPlayingInfo.modified))
+        return;
+    nowPlayingPath = path;
+
+    MediaInfo cached;
+    if (!MediaInfoCache::getSingleton()->lookup(path, nowPlayingInfo.size,
+                                                nowPlayingInfo.modified,
+                                                cached))
+        return;
+    nowPlayingInfo = cached;
+    // Track ids are only selected once mpv has the file open.
+    if (!cached.tracks.isEmpty())
+        updateTracks(cached.tracks, false);
+    if (!cached.chapters.isEmpty())
+        updateChapters(cached.chapters);
+    if (cached.duration > 0) {
+        mpvLength = cached.duration;
+        emit timeChanged(0, mpvLength);
+    }
+}
+
+bool PlaybackManager::isOpeningFile()
+{
+    return playbackState_ == WaitingState || playbackState_ == BufferingState;
+}
+
+bool PlaybackManager::isRecordingMediaInfo()
+{
+    // While waiting for a file to open, reports may still be arriving from
+    // the one before it.
+    return !nowPlayingPath.isEmpty() && playbackState_ != WaitingState
+            && playbackState_ != StoppedState;
+}
+
+void PlaybackManager::recordMediaInfo()
+{
+    MediaInfoCache::getSingleton()->insert(nowPlayingPath, nowPlayingInfo);
+}
+
 void PlaybackManager::openSeveralFiles(QList<QUrl> what, bool important)
 {
     if (important) {
@@ -156,6 +353,11 @@ void PlaybackManager::openSeveralFiles(QList<QUrl> what, bool important)
     }
 }
 
+void PlaybackManager::appendSeveralFiles(QUuid list, QList<QUrl> what)
+{
+    playlistWindow_->addToPlaylist(list, what);
+}
+
 void PlaybackManager::openFile(QUrl what)
 {
     auto info = playlistWindow_->urlToQuickPlaylist(what);
@@ -170,6 +372,7 @@ void PlaybackManager::playDiscFiles(QUrl where)
         mpvWidget_->stopPlayback();
     }
     mpvWidget_->discFilesOpen(where.toLocalFile());
+    forgetPreload();
     nowPlayingItem = QUuid();
     nowPlayingList = QUuid();
     emit nowPlayingChanged(where, QUuid(), QUuid());
@@ -213,6 +416,7 @@ void PlaybackManager::unpausePlayer()
 void PlaybackManager::stopPlayer()
 {
     nowPlayingItem = QUuid();
+    forgetPreload();
     mpvWidget_->stopPlayback();
 }
 
@@ -283,13 +487,22 @@ void PlaybackManager::repeatThisFile()
 
 void PlaybackManager::navigateToChapter(int64_t chapter)
 {
-    if (!mpvWidget_->setChapter(chapter)) {
+    // The usual answers from mpv are:
+    // MPV_ERROR_PROPERTY_UNAVAILABLE: unchaptered file
+    // MPV_ERROR_PROPERTY_FORMAT: past-the-end value requested
+    // MPV_ERROR_SUCCESS: success
+    QUuid item = nowPlayingItem;
+    mpvWidget_->setMpvPropertyVariantAsync("chapter", (qlonglong)chapter, this,
+                                           [this, item](QVariant v) {
+        if (item != nowPlayingItem
+                || v.value<MpvErrorCode>().errorcode() == MPV_ERROR_SUCCESS)
+            return;
         // Out-of-bounds chapter navigation request. i.e. unseekable chapter
         // from either past-the-end or invalid.  So stop playback and continue
         // on the next via the playback finished slot.
         mpvWidget_->setPaused(false);
         mpvWidget_->stopPlayback();
-    }
+    });
 }
 
 void PlaybackManager::navigateToTime(double time)
@@ -365,6 +578,25 @@ void PlaybackManager::setMute(bool muted)
 void PlaybackManager::setPlaybackPlayTimes(int times)
 {
     this->playbackPlayTimes = std::max(0, times);
+    preloadRevision = -1;
+    if (!nowPlayingItem.isNull() && playbackState_ != WaitingState)
+        updatePreload();
+}
+
+void PlaybackManager::playlists_playlistRevised(QUuid list)
+{
+    if (list != nowPlayingList
+            && list != PlaylistCollection::getSingleton()->queuePlaylist()->uuid())
+        return;
+    preloadTimer->start();
+}
+
+void PlaybackManager::preloadTimer_timeout()
+{
+    if (nowPlayingItem.isNull() || playbackState_ == WaitingState)
+        return;
+    if (preloadRevision != playlistWindow_->playOrderRevision(nowPlayingList))
+        updatePreload();
 }
 
 void PlaybackManager::mpvw_playTimeChanged(double time)
@@ -379,12 +611,22 @@ void PlaybackManager::mpvw_playTimeChanged(double time)
 void PlaybackManager::mpvw_playLengthChanged(double length)
 {
     mpvLength = length;
+    if (length > 0 && length != nowPlayingInfo.duration
+            && isRecordingMediaInfo()) {
+        nowPlayingInfo.duration = length;
+        recordMediaInfo();
+    }
 }
 
 void PlaybackManager::mpvw_playbackLoading()
 {
+    // A file starting without us asking for it is the preloaded one.
+    bool advanced = playbackState_ != WaitingState
+            && !preloaded.second.isNull();
     playbackState_ = BufferingState;
     emit stateChanged(playbackState_);
+    if (advanced)
+        advanceToPreloaded();
 }
 
 void PlaybackManager::mpvw_playbackStarted()
@@ -432,64 +674,33 @@ void PlaybackManager::mpvw_chapterDataChanged(QVariantMap metadata)
     emit chapterTitleChanged(metadata.value("title").toString());
 }
 
-void PlaybackManager::mpvw_chaptersChanged(QVariantList chapters)
+void PlaybackManager::mpvw_chaptersChanged(MediaChapterList chapters)
 {
-    QList<QPair<double,QString>> list;
-    for (QVariant v : chapters) {
-        QMap<QString, QVariant> node = v.toMap();
-        QString text = QString("[%1] - %2").arg(
-                toDateFormat(node["time"].toDouble()),
-                node["title"].toString());
-        QPair<double,QString> item(node["time"].toDouble(), text);
-        list.append(item);
+    // don't let the previous file being unloaded clear out the cached list
+    if (chapters.isEmpty() && !nowPlayingInfo.chapters.isEmpty()
+            && isOpeningFile())
+        return;
+    updateChapters(chapters);
+    // the lists are emptied when a file is unloaded, which isn't worth
+    // remembering
+    if (!chapters.isEmpty() && chapters != nowPlayingInfo.chapters
+            && isRecordingMediaInfo()) {
+        nowPlayingInfo.chapters = chapters;
+        recordMediaInfo();
     }
-    numChapters = list.count();
-    emit chaptersAvailable(list);
 }
 
-void PlaybackManager::mpvw_tracksChanged(QVariantList tracks)
+void PlaybackManager::mpvw_tracksChanged(MediaTrackList tracks)
 {
-    videoList.clear();
-    audioList.clear();
-    subtitleList.clear();
-    QPair<int64_t,QString> item;
-
-    auto str = [](QVariantMap map, QString key) {
-        return map[key].toString();
-    };
-    auto formatter = [&str](QVariantMap track) {
-        QString output;
-        output.append(QString("%1: ").arg(str(track,"id")));
-        if (track.contains("codec"))
-            output.append(QString("[%1] ").arg(str(track,"codec")));
-        if (track.contains("lang"))
-            output.append(QString("%1 ").arg(str(track,"lang")));
-        if (track.contains("title"))
-            output.append(QString("- %1 ").arg(str(track,"title")));
-        return output;
-    };
-
-    for (QVariant track : tracks) {
-        QVariantMap t = track.toMap();
-        item.first = t["id"].toLongLong();
-        item.second = formatter(t);
-        if (str(t,"type") == "video") {
-            videoList.append(item);
-        } else if (str(t,"type") == "audio") {
-            audioList.append(item);
-        } else if (str(t,"type") == "sub") {
-            subtitleList.append(item);
-        }
+    if (tracks.isEmpty() && !nowPlayingInfo.tracks.isEmpty()
+            && isOpeningFile())
+        return;
+    updateTracks(tracks, true);
+    if (!tracks.isEmpty() && tracks != nowPlayingInfo.tracks
+            && isRecordingMediaInfo()) {
+        nowPlayingInfo.tracks = tracks;
+        recordMediaInfo();
     }
-    emit videoTracksAvailable(videoList);
-    emit audioTracksAvailable(audioList);
-    emit subtitleTracksAvailable(subtitleList);
-
-    selectDesiredTracks();
-
-    emit hasNoVideo(videoList.empty());
-    emit hasNoAudio(audioList.empty());
-    emit hasNoSubtitles(subtitleList.empty());
 }
 
 void PlaybackManager::mpvw_videoSizeChanged(QSize size)
@@ -530,6 +741,16 @@ void PlaybackManager::mpvw_videoBitrateChanged(double bitrate)
 void PlaybackManager::mpvw_metadataChanged(QVariantMap metadata)
 {
     playlistWindow_->setMetadata(nowPlayingList, nowPlayingItem, metadata);
+    if (!metadata.isEmpty() && isRecordingMediaInfo()) {
+        // merged, so that what only probing finds out is kept
+        QVariantMap merged = nowPlayingInfo.metadata;
+        for (auto i = metadata.constBegin(); i != metadata.constEnd(); ++i)
+            merged.insert(i.key(), i.value());
+        if (merged != nowPlayingInfo.metadata) {
+            nowPlayingInfo.metadata = merged;
+            recordMediaInfo();
+        }
+    }
 }
 
 void PlaybackManager::mpvw_playlistChanged(const QVariantList &playlist)
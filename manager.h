@@ -11,9 +11,11 @@
 #include <QUuid>
 #include <QSize>
 #include <QVariant>
+#include "storage.h"
 
 class MpvWidget;
 class PlaylistWindow;
+class QTimer;
 
 class PlaybackManager : public QObject
 {
@@ -32,11 +34,23 @@ public:
 private:
     void startPlayWithUuid(QUrl what, QUuid playlistUuid, QUuid itemUuid,
                            bool isRepeating);
+    void takeNowPlaying(QUrl what, QUuid playlistUuid, QUuid itemUuid,
+                        bool isRepeating);
+    void updatePreload();
+    void forgetPreload();
+    void advanceToPreloaded();
     void selectDesiredTracks();
+    void updateTracks(const MediaTrackList &tracks, bool selectTracks);
+    void updateChapters(const MediaChapterList &chapters);
+    void restoreMediaInfo(const QUrl &what);
+    bool isOpeningFile();
+    bool isRecordingMediaInfo();
+    void recordMediaInfo();
 
 public slots:
     // load functions
     void openSeveralFiles(QList<QUrl> what, bool important = false);
+    void appendSeveralFiles(QUuid list, QList<QUrl> what);
     void openFile(QUrl what);                   // from load dialog
 
     void playDiscFiles(QUrl where);             // from dvd/bd open
@@ -75,6 +89,8 @@ public slots:
     void setPlaybackPlayTimes(int times);
 
 private slots:
+    void playlists_playlistRevised(QUuid list);
+    void preloadTimer_timeout();
     void mpvw_playTimeChanged(double time);
     void mpvw_playLengthChanged(double length);
     void mpvw_playbackLoading();
@@ -83,8 +99,8 @@ private slots:
     void mpvw_playbackIdling();
     void mpvw_mediaTitleChanged(QString title);
     void mpvw_chapterDataChanged(QVariantMap metadata);
-    void mpvw_chaptersChanged(QVariantList chapters);
-    void mpvw_tracksChanged(QVariantList tracks);
+    void mpvw_chaptersChanged(MediaChapterList chapters);
+    void mpvw_tracksChanged(MediaTrackList tracks);
     void mpvw_videoSizeChanged(QSize size);
     void mpvw_fpsChanged(double fps);
     void mpvw_avsyncChanged(double sync);
@@ -141,6 +157,16 @@ private:
     QString subtitleListSelected;
     int numChapters;
 
+    QString nowPlayingPath;
+    MediaInfo nowPlayingInfo;
+
+    // the item handed to mpv to play after this one, and what it was
+    // worked out from
+    QPair<QUuid, QUuid> preloaded;
+    QUrl preloadedUrl;
+    int preloadRevision;
+    QTimer *preloadTimer;
+
     int playbackPlayTimes;
 };
 
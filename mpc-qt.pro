@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui network widgets
+QT       += core gui network widgets concurrent
 
 QMAKE_CXXFLAGS += -Wall
 
@@ -41,7 +41,10 @@ SOURCES += main.cpp\
     settingswindow.cpp \
     qactioneditor.cpp \
     qdrawnstatus.cpp \
-    ipc.cpp
+    ipc.cpp \
+    prober.cpp \
+    screenshotter.cpp \
+    thumbnailer.cpp
 
 HEADERS  += \
     mpvwidget.h \
@@ -57,7 +60,10 @@ HEADERS  += \
     settingswindow.h \
     qactioneditor.h \
     qdrawnstatus.h \
-    ipc.h
+    ipc.h \
+    prober.h \
+    screenshotter.h \
+    thumbnailer.h
 
 FORMS    += \
     mainwindow.ui \
@@ -7,11 +7,13 @@
 #endif
 #include <QThread>
 #include <QTimer>
+#include <QPointer>
 #include <QOpenGLContext>
 #include <QMetaObject>
 #include <QDir>
 #include <QDebug>
 #include <cmath>
+#include <cstring>
 #include <stdexcept>
 #include <mpv/qthelper.hpp>
 #include "mpvwidget.h"
@@ -30,6 +32,73 @@
 
 
 static const int HOOK_UNLOAD_CALLBACK_ID = 0xdeaddead;
+// Events handled per drain of mpv's queue, before giving queued commands
+// on the controller thread a turn.
+static const int eventBudget = 64;
+
+
+
+static QString nodeString(const mpv_node &node)
+{
+    return node.format == MPV_FORMAT_STRING ? QString::fromUtf8(node.u.string)
+                                            : QString();
+}
+
+static MediaTrackList tracksFromNode(const mpv_node *node)
+{
+    MediaTrackList tracks;
+    if (!node || node->format != MPV_FORMAT_NODE_ARRAY)
+        return tracks;
+    tracks.reserve(node->u.list->num);
+    for (int i = 0; i < node->u.list->num; i++) {
+        const mpv_node &entry = node->u.list->values[i];
+        if (entry.format != MPV_FORMAT_NODE_MAP)
+            continue;
+        MediaTrack track;
+        const mpv_node_list *map = entry.u.list;
+        for (int j = 0; j < map->num; j++) {
+            const char *key = map->keys[j];
+            const mpv_node &value = map->values[j];
+            if (!strcmp(key, "id") && value.format == MPV_FORMAT_INT64)
+                track.id = value.u.int64;
+            else if (!strcmp(key, "type"))
+                track.type = MediaTrack::typeFromName(nodeString(value));
+            else if (!strcmp(key, "codec"))
+                track.codec = nodeString(value);
+            else if (!strcmp(key, "lang"))
+                track.lang = nodeString(value);
+            else if (!strcmp(key, "title"))
+                track.title = nodeString(value);
+        }
+        tracks.append(track);
+    }
+    return tracks;
+}
+
+static MediaChapterList chaptersFromNode(const mpv_node *node)
+{
+    MediaChapterList chapters;
+    if (!node || node->format != MPV_FORMAT_NODE_ARRAY)
+        return chapters;
+    chapters.reserve(node->u.list->num);
+    for (int i = 0; i < node->u.list->num; i++) {
+        const mpv_node &entry = node->u.list->values[i];
+        if (entry.format != MPV_FORMAT_NODE_MAP)
+            continue;
+        MediaChapter chapter;
+        const mpv_node_list *map = entry.u.list;
+        for (int j = 0; j < map->num; j++) {
+            const char *key = map->keys[j];
+            const mpv_node &value = map->values[j];
+            if (!strcmp(key, "time") && value.format == MPV_FORMAT_DOUBLE)
+                chapter.time = value.u.double_;
+            else if (!strcmp(key, "title"))
+                chapter.title = nodeString(value);
+        }
+        chapters.append(chapter);
+    }
+    return chapters;
+}
 
 
 
@@ -108,6 +177,13 @@ MpvWidget::MpvWidget(QWidget *parent, const QString &clientName) :
     // Wire up the event-handling callbacks
     connect(ctrl, &MpvController::mpvPropertyChanged,
             this, &MpvWidget::ctrl_mpvPropertyChanged, Qt::QueuedConnection);
+    connect(ctrl, &MpvController::snapshotReady,
+            this, &MpvWidget::ctrl_snapshotReady, Qt::QueuedConnection);
+    connect(ctrl, &MpvController::trackListChanged,
+            this, &MpvWidget::tracksChanged, Qt::QueuedConnection);
+    connect(ctrl, &MpvController::chapterListChanged,
+            this, &MpvWidget::chaptersChanged, Qt::QueuedConnection);
+    snapshots = ctrl->snapshotBuffer();
     connect(ctrl, &MpvController::logMessage,
             this, &MpvWidget::ctrl_logMessage, Qt::QueuedConnection);
     connect(ctrl, &MpvController::clientMessage,
@@ -132,25 +208,30 @@ MpvWidget::MpvWidget(QWidget *parent, const QString &clientName) :
     // clean up objects when the worker thread is deleted
     connect(worker, &QThread::finished, ctrl, &MpvController::deleteLater);
 
-    // Observe some properties
+    // Observe some properties.  The frequently changing ones go into the
+    // controller's snapshot, and the rest arrive tagged with their id.
     MpvController::PropertyList options = {
-        { "time-pos", 0, MPV_FORMAT_DOUBLE },
-        { "pause", 0, MPV_FORMAT_FLAG },
-        { "media-title", 0, MPV_FORMAT_STRING },
-        { "chapter-metadata", 0, MPV_FORMAT_NODE },
-        { "track-list", 0, MPV_FORMAT_NODE },
-        { "chapter-list", 0, MPV_FORMAT_NODE },
-        { "duration", 0, MPV_FORMAT_DOUBLE },
-        { "estimated-vf-fps", 0, MPV_FORMAT_DOUBLE },
-        { "avsync", 0, MPV_FORMAT_DOUBLE },
-        { "frame-drop-count", 0, MPV_FORMAT_INT64 },
-        { "decoder-frame-drop-count", 0, MPV_FORMAT_INT64 },
-        { "audio-bitrate", 0, MPV_FORMAT_DOUBLE },
-        { "video-bitrate", 0, MPV_FORMAT_DOUBLE },
-        { "paused-for-cache", 0, MPV_FORMAT_FLAG },
-        { "metadata", 0, MPV_FORMAT_NODE },
-        { "audio-device-list", 0, MPV_FORMAT_NODE }
+        { "time-pos", MpvController::TimePosId, MPV_FORMAT_DOUBLE },
+        { "pause", MpvController::PauseId, MPV_FORMAT_FLAG },
+        { "media-title", MpvController::MediaTitleId, MPV_FORMAT_STRING },
+        { "chapter-metadata", MpvController::ChapterMetadataId, MPV_FORMAT_NODE },
+        { "track-list", MpvController::TrackListId, MPV_FORMAT_NODE },
+        { "chapter-list", MpvController::ChapterListId, MPV_FORMAT_NODE },
+        { "duration", MpvController::DurationId, MPV_FORMAT_DOUBLE },
+        { "estimated-vf-fps", MpvController::EstimatedVfFpsId, MPV_FORMAT_DOUBLE },
+        { "avsync", MpvController::AvsyncId, MPV_FORMAT_DOUBLE },
+        { "frame-drop-count", MpvController::FrameDropCountId, MPV_FORMAT_INT64 },
+        { "decoder-frame-drop-count", MpvController::DecoderFrameDropCountId, MPV_FORMAT_INT64 },
+        { "audio-bitrate", MpvController::AudioBitrateId, MPV_FORMAT_DOUBLE },
+        { "video-bitrate", MpvController::VideoBitrateId, MPV_FORMAT_DOUBLE },
+        { "paused-for-cache", MpvController::PausedForCacheId, MPV_FORMAT_FLAG },
+        { "metadata", MpvController::MetadataId, MPV_FORMAT_NODE },
+        { "audio-device-list", MpvController::AudioDeviceListId, MPV_FORMAT_NODE },
+        { "chapter", MpvController::ChapterId, MPV_FORMAT_INT64 },
+        { "eof-reached", MpvController::EofReachedId, MPV_FORMAT_FLAG },
+        { "mpv-version", MpvController::MpvVersionId, MPV_FORMAT_STRING }
     };
+    // ipc clients observing these get them at the throttled rate
     QSet<QString> throttled = {
         "time-pos", "avsync", "estimated-vf-fps", "frame-drop-count",
         "decoder-frame-drop-count", "audio-bitrate", "video-bitrate"
@@ -174,6 +255,7 @@ MpvWidget::MpvWidget(QWidget *parent, const QString &clientName) :
                                         MpvController::LogInfo));
 
     emit ctrlSetOptionVariant("ytdl", "yes");
+    emit ctrlSetOptionVariant("prefetch-playlist", "yes");
     emit ctrlSetOptionVariant("audio-client-name", clientName);
 
     connect(this, &QOpenGLWidget::frameSwapped,
@@ -198,11 +280,6 @@ MpvWidget::~MpvWidget()
     worker->deleteLater();
 }
 
-QList<AudioDevice> MpvWidget::audioDevices()
-{
-    return AudioDevice::listFromVList(getMpvPropertyVariant("audio-devices").toList());
-}
-
 void MpvWidget::showMessage(QString message)
 {
     emit ctrlCommand(QVariantList({"show_text", message, "1000"}));
@@ -210,10 +287,24 @@ void MpvWidget::showMessage(QString message)
 
 void MpvWidget::fileOpen(QString filename)
 {
+    // loading a file this way replaces mpv's playlist
+    preloadedFile.clear();
     emit ctrlCommand(QStringList({"loadfile", filename}));
     setPaused(false);
 }
 
+void MpvWidget::setPreloadedFile(QString filename)
+{
+    // Keep at most one file queued up after the current one in mpv's own
+    // playlist, so that mpv can prefetch it and move on to it without a gap.
+    if (filename == preloadedFile)
+        return;
+    preloadedFile = filename;
+    emit ctrlCommand(QStringList({"playlist-clear"}));
+    if (!filename.isEmpty())
+        emit ctrlCommand(QStringList({"loadfile", filename, "append"}));
+}
+
 void MpvWidget::discFilesOpen(QString path) {
     QStringList entryList = QDir(path).entryList();
     if (entryList.contains("VIDEO_TS") || entryList.contains("AUDIO_TS")) {
@@ -225,6 +316,7 @@ void MpvWidget::discFilesOpen(QString path) {
 
 void MpvWidget::stopPlayback()
 {
+    preloadedFile.clear();
     emit ctrlCommand("stop");
 }
 
@@ -246,11 +338,6 @@ void MpvWidget::seek(double amount, bool exact)
     emit ctrlCommand(payload);
 }
 
-void MpvWidget::screenshot(const QString &fileName, bool subtitles)
-{
-    emit ctrlCommand(QStringList({"screenshot-to-file", fileName, subtitles ? "subtitles" : "video"}));
-}
-
 void MpvWidget::setLogoUrl(const QString &filename)
 {
     makeCurrent();
@@ -272,32 +359,6 @@ void MpvWidget::setLoopImages(bool yes)
                               yes ? QVariant("inf") : QVariant(1.0));
 }
 
-int64_t MpvWidget::chapter()
-{
-    return getMpvPropertyVariant("chapter").toLongLong();
-}
-
-bool MpvWidget::setChapter(int64_t chapter)
-{
-    // As this requires knowledge of mpv's return value, it cannot be
-    // queued as a simple message.  The usual return values are:
-    // MPV_ERROR_PROPERTY_UNAVAILABLE: unchaptered file
-    // MPV_ERROR_PROPERTY_FORMAT: past-the-end value requested
-    // MPV_ERROR_SUCCESS: success
-    int r;
-    QMetaObject::invokeMethod(ctrl, "setPropertyVariant",
-                              Qt::BlockingQueuedConnection,
-                              Q_RETURN_ARG(int, r),
-                              Q_ARG(QString, "chapter"),
-                              Q_ARG(QVariant, QVariant((qlonglong)chapter)));
-    return r == MPV_ERROR_SUCCESS;
-}
-
-QString MpvWidget::mediaTitle()
-{
-    return getMpvPropertyVariant("media-title").toString();
-}
-
 void MpvWidget::setMute(bool yes)
 {
     setMpvPropertyVariant("mute", yes);
@@ -347,19 +408,29 @@ void MpvWidget::setDrawLogo(bool yes)
     update();
 }
 
-QString MpvWidget::mpvVersion()
+void MpvWidget::setVolume(int64_t volume)
 {
-    return getMpvPropertyVariant("mpv-version").toString();
+    setMpvPropertyVariant("volume", (long long)volume);
 }
 
-void MpvWidget::setVolume(int64_t volume)
+int64_t MpvWidget::chapter() const
 {
-    setMpvPropertyVariant("volume", (long long)volume);
+    return mirror.value("chapter").toLongLong();
 }
 
-bool MpvWidget::eofReached()
+bool MpvWidget::eofReached() const
 {
-    return getMpvPropertyVariant("eof-reached").toBool();
+    return mirror.value("eof-reached").toBool();
+}
+
+QString MpvWidget::mediaTitle() const
+{
+    return mirror.value("media-title").toString();
+}
+
+QString MpvWidget::mpvVersion() const
+{
+    return mirror.value("mpv-version").toString();
 }
 
 void MpvWidget::setSubsAreGray(bool yes)
@@ -407,31 +478,11 @@ void MpvWidget::setScreenshotJpegQuality(int64_t value)
     setCachedMpvOption("screenshot-jpeg-quality", (long long)value);
 }
 
-void MpvWidget::setScreenshotJpegSmooth(int64_t value)
-{
-    setCachedMpvOption("screenshot-jpeg-smooth", (long long)value);
-}
-
-void MpvWidget::setScreenshotJpegSourceChroma(bool yes)
-{
-    setCachedMpvOption("screenshot-jpeg-source-chroma", yes);
-}
-
 void MpvWidget::setScreenshotPngCompression(int64_t value)
 {
     setCachedMpvOption("screenshot-png-compression", (long long)value);
 }
 
-void MpvWidget::setScreenshotPngFilter(int64_t value)
-{
-    setCachedMpvOption("screenshot-png-filter", (long long)value);
-}
-
-void MpvWidget::setScreenshotPngColorspace(bool yes)
-{
-    setCachedMpvOption("screenshot-tag-colorspace", yes);
-}
-
 void MpvWidget::setClientDebuggingMessages(bool yes)
 {
     debugMessages = yes;
@@ -470,48 +521,128 @@ void MpvWidget::setCachedMpvOption(const QString &option, const QVariant &value)
     setMpvOptionVariant(option, value);
 }
 
-QVariant MpvWidget::blockingMpvCommand(QVariant params)
+void MpvWidget::mpvCommandAsync(QVariant params, QObject *context,
+                                const Callback &callback)
 {
-    QVariant v;
-    QMetaObject::invokeMethod(ctrl, "command",
-                              Qt::BlockingQueuedConnection,
-                              Q_RETURN_ARG(QVariant, v),
-                              Q_ARG(QVariant, params));
-    return v;
+    QMetaObject::invokeMethod(ctrl, "commandAsync", Qt::QueuedConnection,
+                              Q_ARG(QVariant, params),
+                              Q_ARG(MpvCallback*, makeCallback(context, callback)));
 }
 
-QVariant MpvWidget::blockingSetMpvPropertyVariant(QString name, QVariant value)
+void MpvWidget::setMpvPropertyVariantAsync(QString name, QVariant value,
+                                           QObject *context,
+                                           const Callback &callback)
 {
-    int v;
-    QMetaObject::invokeMethod(ctrl, "setPropertyVariant",
-                              Qt::BlockingQueuedConnection,
-                              Q_RETURN_ARG(int, v),
-                              Q_ARG(QString, name),
-                              Q_ARG(QVariant, value));
-    return v == MPV_ERROR_SUCCESS ? QVariant()
-                                  : QVariant::fromValue(MpvErrorCode(v));
+    // The bookkeeping is finished even if the context has gone away.
+    beginPropertySet(name);
+    QPointer<MpvWidget> self(this);
+    QPointer<QObject> guard(context);
+    MpvCallback *reply = new MpvCallback([self, guard, name, callback](QVariant v) {
+        if (self)
+            self->endPropertySet(name);
+        if (guard)
+            callback(v);
+    });
+    QMetaObject::invokeMethod(ctrl, "setPropertyVariantAsync",
+                              Qt::QueuedConnection,
+                              Q_ARG(QString, name), Q_ARG(QVariant, value),
+                              Q_ARG(MpvCallback*, reply));
 }
 
-QVariant MpvWidget::blockingSetMpvOptionVariant(QString name, QVariant value)
+void MpvWidget::setMpvOptionVariantAsync(QString name, QVariant value,
+                                         QObject *context,
+                                         const Callback &callback)
 {
-    int v;
-    QMetaObject::invokeMethod(ctrl, "setOptionVariant",
-                              Qt::BlockingQueuedConnection,
-                              Q_RETURN_ARG(int, v),
-                              Q_ARG(QString, name),
-                              Q_ARG(QVariant, value));
-    return v == MPV_ERROR_SUCCESS ? QVariant()
-                                  : QVariant::fromValue(MpvErrorCode(v));
+    QMetaObject::invokeMethod(ctrl, "setOptionVariantAsync",
+                              Qt::QueuedConnection,
+                              Q_ARG(QString, name), Q_ARG(QVariant, value),
+                              Q_ARG(MpvCallback*, makeCallback(context, callback)));
 }
 
-QVariant MpvWidget::getMpvPropertyVariant(QString name)
+void MpvWidget::getMpvPropertyVariantAsync(QString name, QObject *context,
+                                           const Callback &callback)
 {
-    QVariant v;
-    QMetaObject::invokeMethod(ctrl, "getPropertyVariant",
-                              Qt::BlockingQueuedConnection,
-                              Q_RETURN_ARG(QVariant, v),
-                              Q_ARG(QString, name));
-    return v;
+    auto i = mirror.constFind(name);
+    if (i != mirror.constEnd() && !unmirrored.contains(name)) {
+        if (context)
+            callback(i.value());
+        return;
+    }
+    QMetaObject::invokeMethod(ctrl, "getPropertyVariantAsync",
+                              Qt::QueuedConnection, Q_ARG(QString, name),
+                              Q_ARG(MpvCallback*, makeCallback(context, callback)));
+}
+
+void MpvWidget::getMpvPropertyStringAsync(QString name, QObject *context,
+                                          const Callback &callback)
+{
+    QMetaObject::invokeMethod(ctrl, "getPropertyStringAsync",
+                              Qt::QueuedConnection, Q_ARG(QString, name),
+                              Q_ARG(MpvCallback*, makeCallback(context, callback)));
+}
+
+void MpvWidget::grabFrameAsync(bool subtitles, QObject *context,
+                               const Callback &callback)
+{
+    QMetaObject::invokeMethod(ctrl, "grabFrame", Qt::QueuedConnection,
+                              Q_ARG(bool, subtitles),
+                              Q_ARG(MpvCallback*, makeCallback(context, callback)));
+}
+
+void MpvWidget::unobserveMpvPropertiesAsync(QSet<uint64_t> ids,
+                                            QObject *context,
+                                            const Callback &callback)
+{
+    QMetaObject::invokeMethod(ctrl, "unobservePropertiesByIdAsync",
+                              Qt::QueuedConnection,
+                              Q_ARG(QSet<uint64_t>, ids),
+                              Q_ARG(MpvCallback*, makeCallback(context, callback)));
+}
+
+void MpvWidget::setMpvPropertyPolicyAsync(uint64_t id, int policy, int msec,
+                                          QObject *context,
+                                          const Callback &callback)
+{
+    QMetaObject::invokeMethod(ctrl, "setPropertyPolicyByIdAsync",
+                              Qt::QueuedConnection,
+                              Q_ARG(uint64_t, id), Q_ARG(int, policy),
+                              Q_ARG(int, msec),
+                              Q_ARG(MpvCallback*, makeCallback(context, callback)));
+}
+
+MpvCallback *MpvWidget::makeCallback(QObject *context, const Callback &callback)
+{
+    // mpv holds on to the callback until it replies, so it cannot be owned
+    // by the context.  Instead it goes quiet when the context goes away.
+    QPointer<QObject> guard(context);
+    return new MpvCallback([guard, callback](QVariant v) {
+        if (guard)
+            callback(v);
+    });
+}
+
+void MpvWidget::mirrorProperty(const QString &name, const QVariant &v)
+{
+    // Unavailable properties are kept as the error code mpv gave, which is
+    // what a fetch would have answered with.
+    mirror.insert(name, v);
+    if (!settingProperties.contains(name))
+        unmirrored.remove(name);
+}
+
+void MpvWidget::beginPropertySet(const QString &name)
+{
+    // Until mpv reports the change back, the mirror holds the value from
+    // before the set, so reads go to mpv itself.  mpv handles them after the
+    // set, so they see its result.
+    settingProperties[name]++;
+    unmirrored.insert(name);
+}
+
+void MpvWidget::endPropertySet(const QString &name)
+{
+    if (--settingProperties[name] <= 0)
+        settingProperties.remove(name);
 }
 
 void MpvWidget::initializeGL()
@@ -575,44 +706,71 @@ void MpvWidget::ctrl_update(void *ctx)
     QMetaObject::invokeMethod(reinterpret_cast<MpvWidget*>(ctx), "maybeUpdate");
 }
 
-#define HANDLE_PROP_1(p, method, converter, dflt) \
-    if (name == p) { \
+#define HANDLE_PROP(id, method, converter, dflt) \
+    case MpvController::id: \
         if (ok && v.canConvert<decltype(dflt)>()) \
             method(v.converter()); \
         else \
             method(dflt); \
-        return; \
-    }
-#define HANDLE_PROP_2(p, method, converter, dflt) \
-    if (name == p) { \
-        if (ok) \
-            method(v.converter()); \
-        else \
-            method(dflt); \
-        return; \
-    }
+        break;
 
-void MpvWidget::ctrl_mpvPropertyChanged(QString name, QVariant v)
+void MpvWidget::ctrl_mpvPropertyChanged(QString name, QVariant v,
+                                        uint64_t userData)
 {
     if (debugMessages)
         qDebug() << "property changed " << name << v;
 
+    if (MpvController::isInternalId(userData))
+        mirrorProperty(name, v);
+
     bool ok = v.type() < QVariant::UserType;
-    HANDLE_PROP_1("time-pos", self_playTimeChanged, toDouble, -1.0);
-    HANDLE_PROP_1("duration", self_playLengthChanged, toDouble, -1.0);
-    HANDLE_PROP_1("pause", pausedChanged, toBool, true);
-    HANDLE_PROP_1("media-title", mediaTitleChanged, toString, QString());
-    HANDLE_PROP_1("chapter-metadata", chapterDataChanged, toMap, QVariantMap());
-    HANDLE_PROP_1("chapter-list", chaptersChanged, toList, QVariantList());
-    HANDLE_PROP_1("track-list", tracksChanged, toList, QVariantList());
-    HANDLE_PROP_1("estimated-vf-fps", fpsChanged, toDouble, 0.0);
-    HANDLE_PROP_1("avsync", avsyncChanged, toDouble, 0.0);
-    HANDLE_PROP_1("frame-drop-count", displayFramedropsChanged, toLongLong, 0ll);
-    HANDLE_PROP_1("decoder-frame-drop-count", decoderFramedropsChanged, toLongLong, 0ll);
-    HANDLE_PROP_1("audio-bitrate", audioBitrateChanged, toDouble, 0.0);
-    HANDLE_PROP_1("video-bitrate", videoBitrateChanged, toDouble, 0.0);
-    HANDLE_PROP_1("metadata", self_metadata, toMap, QVariantMap());
-    HANDLE_PROP_1("audio-device-list", self_audioDeviceList, toList, QVariantList());
+    switch (userData) {
+    HANDLE_PROP(DurationId, self_playLengthChanged, toDouble, -1.0);
+    HANDLE_PROP(PauseId, pausedChanged, toBool, true);
+    HANDLE_PROP(MediaTitleId, mediaTitleChanged, toString, QString());
+    HANDLE_PROP(ChapterMetadataId, chapterDataChanged, toMap, QVariantMap());
+    HANDLE_PROP(MetadataId, self_metadata, toMap, QVariantMap());
+    HANDLE_PROP(AudioDeviceListId, self_audioDeviceList, toList, QVariantList());
+    default:
+        break;
+    }
+}
+
+void MpvWidget::ctrl_snapshotReady()
+{
+    PlaybackSnapshot s;
+    if (!snapshots->take(s))
+        return;
+    if (s.timePos != snapshot.timePos) {
+        self_playTimeChanged(s.timePos);
+        mirrorProperty("time-pos", s.timePos >= 0 ? QVariant(s.timePos)
+                       : QVariant::fromValue(MpvErrorCode(MPV_ERROR_PROPERTY_UNAVAILABLE)));
+    }
+    if (s.fps != snapshot.fps) {
+        emit fpsChanged(s.fps);
+        mirrorProperty("estimated-vf-fps", s.fps);
+    }
+    if (s.avsync != snapshot.avsync) {
+        emit avsyncChanged(s.avsync);
+        mirrorProperty("avsync", s.avsync);
+    }
+    if (s.frameDrops != snapshot.frameDrops) {
+        emit displayFramedropsChanged(s.frameDrops);
+        mirrorProperty("frame-drop-count", (qlonglong)s.frameDrops);
+    }
+    if (s.decoderDrops != snapshot.decoderDrops) {
+        emit decoderFramedropsChanged(s.decoderDrops);
+        mirrorProperty("decoder-frame-drop-count", (qlonglong)s.decoderDrops);
+    }
+    if (s.audioBitrate != snapshot.audioBitrate) {
+        emit audioBitrateChanged(s.audioBitrate);
+        mirrorProperty("audio-bitrate", s.audioBitrate);
+    }
+    if (s.videoBitrate != snapshot.videoBitrate) {
+        emit videoBitrateChanged(s.videoBitrate);
+        mirrorProperty("video-bitrate", s.videoBitrate);
+    }
+    snapshot = s;
 }
 
 void MpvWidget::ctrl_logMessage(QString message)
@@ -624,10 +782,21 @@ void MpvWidget::ctrl_clientMessage(uint64_t id, const QStringList &args)
 {
     Q_UNUSED(id);
     if (args[1] == QString::number(HOOK_UNLOAD_CALLBACK_ID)) {
-        QVariantList playlist = getMpvPropertyVariant("playlist").toList();
-        if (playlist.count() > 1)
-            playlistChanged(playlist);
-        emit ctrlCommand(QStringList({"hook-ack", args[2]}));
+        // The file preloaded for gapless playback is not something the file
+        // being unloaded expanded into.  mpv waits on the hook until it is
+        // acknowledged, so the playlist is still the one to look at.
+        QString preloaded = preloadedFile;
+        QString hookId = args[2];
+        getMpvPropertyVariantAsync("playlist", this,
+                                   [this, preloaded, hookId](QVariant v) {
+            QVariantList playlist;
+            for (const QVariant &entry : v.toList())
+                if (entry.toMap()["filename"].toString() != preloaded)
+                    playlist.append(entry);
+            if (playlist.count() > 1)
+                playlistChanged(playlist);
+            emit ctrlCommand(QStringList({"hook-ack", hookId}));
+        });
     }
 }
 
@@ -733,14 +902,37 @@ void MpvCallback::reply(QVariant value)
 
 
 
+SnapshotBuffer::SnapshotBuffer() : middle(1), back(0), front(2)
+{
+}
+
+void SnapshotBuffer::publish(const PlaybackSnapshot &snapshot)
+{
+    buffers[back] = snapshot;
+    back = middle.fetchAndStoreAcqRel(back | FreshBit) & IndexMask;
+}
+
+bool SnapshotBuffer::take(PlaybackSnapshot &snapshot)
+{
+    if (!(middle.loadAcquire() & FreshBit))
+        return false;
+    front = middle.fetchAndStoreAcqRel(front) & IndexMask;
+    snapshot = buffers[front];
+    return true;
+}
+
+
+
 MpvController::MpvController(QObject *parent) : QObject(parent),
-    glMpv(NULL), lastVideoSize(0,0)
+    glMpv(NULL), lastVideoSize(0,0), flushDue(-1), throttleTime(1000/12),
+    snapshotDue(-1)
 {
     throttler = new QTimer(this);
+    throttler->setSingleShot(true);
+    throttler->setTimerType(Qt::PreciseTimer);
     connect(throttler, &QTimer::timeout,
             this, &MpvController::flushProperties);
-    throttler->setInterval(1000/12);
-    throttler->start();
+    clock.start();
 }
 
 MpvController::~MpvController()
@@ -749,6 +941,26 @@ MpvController::~MpvController()
     throttler->deleteLater();
 }
 
+SnapshotBuffer *MpvController::snapshotBuffer()
+{
+    return &snapshots;
+}
+
+int MpvController::wakeupCount() const
+{
+    return wakeups.loadAcquire();
+}
+
+int MpvController::drainCount() const
+{
+    return drains.loadAcquire();
+}
+
+bool MpvController::isInternalId(uint64_t id)
+{
+    return id > InternalIdBase && id < InternalIdEnd;
+}
+
 void MpvController::create(bool video, bool audio)
 {
     mpv = mpv::qt::Handle::FromRawHandle(mpv_create());
@@ -788,21 +1000,44 @@ int MpvController::observeProperties(const MpvController::PropertyList &properti
     int rval = 0;
     foreach (const MpvProperty &item, properties)
         rval  = std::min(rval, mpv_observe_property(mpv, item.userData, item.name.toUtf8().data(), item.format));
-    throttledProperties.unite(throttled);
+    foreach (const QString &name, throttled)
+        namePolicies.insert(name, PropertyPolicy(Coalesce));
     return rval;
 }
 
 int MpvController::unobservePropertiesById(const QSet<uint64_t> &ids)
 {
     int rval = 0;
-    foreach (uint64_t id, ids)
+    foreach (uint64_t id, ids) {
         rval = std::min(rval, mpv_unobserve_property(mpv, id));
+        idPolicies.remove(id);
+        propertyStates.remove(id);
+        pendingIds.remove(id);
+    }
     return rval;
 }
 
 void MpvController::setThrottleTime(int msec)
 {
-    throttler->setInterval(msec);
+    throttleTime = qMax(0, msec);
+}
+
+void MpvController::setPropertyPolicy(const QString &name, int policy, int msec)
+{
+    namePolicies.insert(name, PropertyPolicy(ThrottlePolicy(policy), qMax(0, msec)));
+}
+
+int MpvController::setPropertyPolicyById(uint64_t id, int policy, int msec)
+{
+    if (policy < Immediate || policy > MaxRate || msec < 0)
+        return MPV_ERROR_INVALID_PARAMETER;
+    idPolicies.insert(id, PropertyPolicy(ThrottlePolicy(policy), qMax(0, msec)));
+    // anything held back under the old policy goes out on the next flush
+    if (policy == Immediate && pendingIds.contains(id)) {
+        propertyStates[id].due = clock.elapsed();
+        scheduleFlush(propertyStates[id].due);
+    }
+    return MPV_ERROR_SUCCESS;
 }
 
 QString MpvController::clientName()
@@ -888,9 +1123,10 @@ QString MpvController::getPropertyString(const QString &name)
 
 void MpvController::commandAsync(const QVariant &params, MpvCallback *callback)
 {
-    mpv::qt::node_builder node(params);
-    mpv_command_node_async(mpv, reinterpret_cast<uint64_t>(callback),
-                           node.node());
+    // mpv's async command reply carries no result, and commands such as
+    // expand-text are only useful for theirs, so this runs it from here.
+    QMetaObject::invokeMethod(callback, "reply", Qt::QueuedConnection,
+                              Q_ARG(QVariant, command(params)));
 }
 
 void MpvController::setPropertyVariantAsync(const QString &name,
@@ -909,29 +1145,276 @@ void MpvController::getPropertyVariantAsync(const QString &name,
                            name.toUtf8().data(), MPV_FORMAT_NODE);
 }
 
+void MpvController::getPropertyStringAsync(const QString &name,
+                                           MpvCallback *callback)
+{
+    mpv_get_property_async(mpv, reinterpret_cast<uint64_t>(callback),
+                           name.toUtf8().data(), MPV_FORMAT_STRING);
+}
+
+void MpvController::setOptionVariantAsync(const QString &name,
+                                          const QVariant &value,
+                                          MpvCallback *callback)
+{
+    // libmpv only sets options synchronously, so this answers from here
+    int r = setOptionVariant(name, value);
+    QMetaObject::invokeMethod(callback, "reply", Qt::QueuedConnection,
+                              Q_ARG(QVariant, QVariant::fromValue(MpvErrorCode(r))));
+}
+
+void MpvController::grabFrame(bool subtitles, MpvCallback *callback)
+{
+    QMetaObject::invokeMethod(callback, "reply", Qt::QueuedConnection,
+                              Q_ARG(QVariant, screenshotRaw(subtitles)));
+}
+
+void MpvController::unobservePropertiesByIdAsync(const QSet<uint64_t> &ids,
+                                                 MpvCallback *callback)
+{
+    int r = unobservePropertiesById(ids);
+    QMetaObject::invokeMethod(callback, "reply", Qt::QueuedConnection,
+                              Q_ARG(QVariant, QVariant::fromValue(MpvErrorCode(r))));
+}
+
+void MpvController::setPropertyPolicyByIdAsync(uint64_t id, int policy,
+                                               int msec, MpvCallback *callback)
+{
+    int r = setPropertyPolicyById(id, policy, msec);
+    QMetaObject::invokeMethod(callback, "reply", Qt::QueuedConnection,
+                              Q_ARG(QVariant, QVariant::fromValue(MpvErrorCode(r))));
+}
+
+QVariant MpvController::screenshotRaw(bool subtitles)
+{
+    mpv::qt::node_builder node(QStringList({"screenshot-raw",
+                                            subtitles ? "subtitles" : "video"}));
+    mpv_node res;
+    int r = mpv_command_node(mpv, node.node(), &res);
+    if (r < 0)
+        return QVariant::fromValue(MpvErrorCode(r));
+    mpv::qt::node_autofree f(&res);
+    return frameFromNode(&res);
+}
+
+QVariant MpvController::frameFromNode(const mpv_node *node)
+{
+    int64_t w = 0, h = 0, stride = 0;
+    const char *format = "";
+    const mpv_byte_array *data = NULL;
+    if (node->format == MPV_FORMAT_NODE_MAP) {
+        const mpv_node_list *map = node->u.list;
+        for (int i = 0; i < map->num; i++) {
+            const char *key = map->keys[i];
+            const mpv_node &value = map->values[i];
+            if (!strcmp(key, "w") && value.format == MPV_FORMAT_INT64)
+                w = value.u.int64;
+            else if (!strcmp(key, "h") && value.format == MPV_FORMAT_INT64)
+                h = value.u.int64;
+            else if (!strcmp(key, "stride") && value.format == MPV_FORMAT_INT64)
+                stride = value.u.int64;
+            else if (!strcmp(key, "format") && value.format == MPV_FORMAT_STRING)
+                format = value.u.string;
+            else if (!strcmp(key, "data") && value.format == MPV_FORMAT_BYTE_ARRAY)
+                data = value.u.ba;
+        }
+    }
+    if (!data || w <= 0 || h <= 0 || stride < w * 4
+            || (int64_t)data->size < stride * (h - 1) + w * 4
+            || strcmp(format, "bgr0"))
+        return QVariant::fromValue(MpvErrorCode(MPV_ERROR_GENERIC));
+
+    // bgr0 is laid out in memory the same way as QImage::Format_RGB32.
+    if (frameBuffer.width() != w || frameBuffer.height() != h
+            || !frameBuffer.isDetached())
+        frameBuffer = QImage(w, h, QImage::Format_RGB32);
+    const char *bytes = reinterpret_cast<const char*>(data->data);
+    for (int y = 0; y < h; y++)
+        memcpy(frameBuffer.scanLine(y), bytes + y * stride, w * 4);
+    return QVariant::fromValue(frameBuffer);
+}
+
 void MpvController::parseMpvEvents()
 {
-    // Process all events, until the event queue is empty.
-    while (mpv) {
+    // Clear the flag first, so that a wakeup arriving while we drain queues
+    // another drain instead of being lost.
+    drainScheduled.storeRelease(0);
+    drains.ref();
+
+    // Process events until the queue is empty or the budget runs out.
+    for (int budget = eventBudget; mpv && budget > 0; budget--) {
         mpv_event *event = mpv_wait_event(mpv, 0);
-        if (event->event_id == MPV_EVENT_NONE) {
-            break;
-        }
+        if (event->event_id == MPV_EVENT_NONE)
+            return;
         handleMpvEvent(event);
     }
+    // mpv won't wake us for events it already has, so come back for the
+    // rest after whatever else was queued on this thread.
+    if (mpv)
+        scheduleDrain();
 }
 
-void MpvController::setThrottledProperty(const QString &name, const QVariant &v, uint64_t userData)
+void MpvController::scheduleDrain()
 {
-    throttledValues.insert(name, QPair<QVariant,uint64_t>(v,userData));
+    if (drainScheduled.testAndSetOrdered(0, 1))
+        QMetaObject::invokeMethod(this, "parseMpvEvents",
+                                  Qt::QueuedConnection);
+}
+
+MpvController::PropertyPolicy MpvController::policyOf(const QString &name,
+                                                     uint64_t userData) const
+{
+    // A policy asked for by an observer overrides the one for the name.
+    PropertyPolicy p = idPolicies.value(userData, namePolicies.value(name));
+    if (p.interval <= 0)
+        p.interval = throttleTime;
+    return p;
+}
+
+void MpvController::propertyChanged(const QString &name, const QVariant &v,
+                                    uint64_t userData)
+{
+    PropertyPolicy p = policyOf(name, userData);
+    if (p.policy == Immediate) {
+        emit mpvPropertyChanged(name, v, userData);
+        return;
+    }
+
+    PropertyState &state = propertyStates[userData];
+    qint64 now = clock.elapsed();
+    switch (p.policy) {
+    case OnChange:
+        if (state.hasLastValue && state.lastValue == v)
+            return;
+        state.lastValue = v;
+        state.hasLastValue = true;
+        emit mpvPropertyChanged(name, v, userData);
+        return;
+    case MaxRate:
+        if (state.due < 0 && (state.lastSent < 0
+                              || now - state.lastSent >= p.interval)) {
+            state.lastSent = now;
+            emit mpvPropertyChanged(name, v, userData);
+            return;
+        }
+        if (state.due < 0)
+            state.due = state.lastSent + p.interval;
+        break;
+    default:
+        if (state.due < 0)
+            state.due = now + p.interval;
+        break;
+    }
+    state.name = name;
+    state.pendingValue = v;
+    pendingIds.insert(userData);
+    scheduleFlush(state.due);
+}
+
+void MpvController::scheduleFlush(qint64 due)
+{
+    if (flushDue >= 0 && flushDue <= due)
+        return;
+    flushDue = due;
+    throttler->start(int(qMax<qint64>(0, due - clock.elapsed())));
 }
 
 void MpvController::flushProperties()
 {
-    foreach (QString key, throttledValues.keys())
-        emit mpvPropertyChanged(key, throttledValues[key].first,
-                                throttledValues[key].second);
-    throttledValues.clear();
+    qint64 now = clock.elapsed();
+    qint64 next = -1;
+    auto later = [&next](qint64 due) {
+        if (next < 0 || due < next)
+            next = due;
+    };
+
+    flushDue = -1;
+    for (auto i = pendingIds.begin(); i != pendingIds.end(); ) {
+        PropertyState &state = propertyStates[*i];
+        if (state.due > now) {
+            later(state.due);
+            ++i;
+            continue;
+        }
+        QVariant v = state.pendingValue;
+        state.pendingValue = QVariant();
+        state.lastSent = now;
+        state.due = -1;
+        emit mpvPropertyChanged(state.name, v, *i);
+        i = pendingIds.erase(i);
+    }
+    if (snapshotDue >= 0) {
+        if (snapshotDue > now) {
+            later(snapshotDue);
+        } else {
+            snapshots.publish(snapshot);
+            snapshotDue = -1;
+            emit snapshotReady();
+        }
+    }
+    if (next >= 0)
+        scheduleFlush(next);
+}
+
+bool MpvController::updateSnapshot(uint64_t id, mpv_event_property *prop)
+{
+    // Unavailable properties come through without data, and take the same
+    // defaults as the gui always gave them.
+    auto asDouble = [prop](double dflt) {
+        return (prop->format != MPV_FORMAT_DOUBLE || prop->data == NULL) ?
+                    dflt : *reinterpret_cast<double*>(prop->data);
+    };
+    auto asInt64 = [prop](int64_t dflt) {
+        return (prop->format != MPV_FORMAT_INT64 || prop->data == NULL) ?
+                    dflt : *reinterpret_cast<int64_t*>(prop->data);
+    };
+    switch (id) {
+    case TimePosId:
+        snapshot.timePos = asDouble(-1.0);
+        break;
+    case EstimatedVfFpsId:
+        snapshot.fps = asDouble(0.0);
+        break;
+    case AvsyncId:
+        snapshot.avsync = asDouble(0.0);
+        break;
+    case FrameDropCountId:
+        snapshot.frameDrops = asInt64(0);
+        break;
+    case DecoderFrameDropCountId:
+        snapshot.decoderDrops = asInt64(0);
+        break;
+    case AudioBitrateId:
+        snapshot.audioBitrate = asDouble(0.0);
+        break;
+    case VideoBitrateId:
+        snapshot.videoBitrate = asDouble(0.0);
+        break;
+    default:
+        return false;
+    }
+    if (snapshotDue < 0) {
+        snapshotDue = clock.elapsed() + throttleTime;
+        scheduleFlush(snapshotDue);
+    }
+    return true;
+}
+
+bool MpvController::updateLists(uint64_t id, mpv_event_property *prop)
+{
+    // These lists can run to hundreds of entries, so they are read straight
+    // out of mpv's node instead of going through a tree of variants.
+    const mpv_node *node = (prop->format == MPV_FORMAT_NODE && prop->data) ?
+                reinterpret_cast<mpv_node*>(prop->data) : NULL;
+    switch (id) {
+    case TrackListId:
+        emit trackListChanged(tracksFromNode(node));
+        return true;
+    case ChapterListId:
+        emit chapterListChanged(chaptersFromNode(node));
+        return true;
+    default:
+        return false;
+    }
 }
 
 void MpvController::handleMpvEvent(mpv_event *event)
@@ -987,7 +1470,6 @@ void MpvController::handleMpvEvent(mpv_event *event)
                                   Q_ARG(QVariant, v));
         break;
     }
-    case MPV_EVENT_COMMAND_REPLY:
     case MPV_EVENT_SET_PROPERTY_REPLY: {
         QVariant v = QVariant::fromValue<MpvErrorCode>(MpvErrorCode(event->error));
         if (!event->reply_userdata)
@@ -998,12 +1480,14 @@ void MpvController::handleMpvEvent(mpv_event *event)
         break;
     }
     case MPV_EVENT_PROPERTY_CHANGE: {
+        if (updateSnapshot(event->reply_userdata,
+                           reinterpret_cast<mpv_event_property*>(event->data))
+                || updateLists(event->reply_userdata,
+                               reinterpret_cast<mpv_event_property*>(event->data)))
+            break;
         QVariant v = propertyToVariant(reinterpret_cast<mpv_event_property*>(event->data));
         QString propname = QString::fromUtf8(reinterpret_cast<mpv_event_property*>(event->data)->name);
-        if (throttledProperties.contains(propname))
-            setThrottledProperty(propname, v, event->reply_userdata);
-        else
-            emit mpvPropertyChanged(propname, v, event->reply_userdata);
+        propertyChanged(propname, v, event->reply_userdata);
         break;
     }
     case MPV_EVENT_LOG_MESSAGE: {
@@ -1048,6 +1532,7 @@ void MpvController::handleMpvEvent(mpv_event *event)
 
 void MpvController::mpvWakeup(void *ctx)
 {
-    QMetaObject::invokeMethod((MpvController*)ctx, "parseMpvEvents",
-                              Qt::QueuedConnection);
+    MpvController *ctrl = reinterpret_cast<MpvController*>(ctx);
+    ctrl->wakeups.ref();
+    ctrl->scheduleDrain();
 }
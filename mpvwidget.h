@@ -3,8 +3,12 @@
 
 #include <QOpenGLWidget>
 #include <QOpenGLTexture>
+#include <QImage>
 #include <QVariant>
 #include <QSet>
+#include <QHash>
+#include <QElapsedTimer>
+#include <QAtomicInt>
 #include <functional>
 #include <mpv/client.h>
 #include <mpv/opengl_cb.h>
@@ -14,31 +18,45 @@
 class QThread;
 class QTimer;
 class MpvController;
+class MpvCallback;
+class SnapshotBuffer;
 class LogoDrawer;
 
+// The frequently changing scalar properties of playback.  These are handed
+// to the gui as a whole, rather than one queued signal per change.
+struct PlaybackSnapshot {
+    PlaybackSnapshot() : timePos(-1), avsync(0), fps(0), frameDrops(0),
+        decoderDrops(0), audioBitrate(0), videoBitrate(0) {}
+    double timePos;
+    double avsync;
+    double fps;
+    int64_t frameDrops;
+    int64_t decoderDrops;
+    double audioBitrate;
+    double videoBitrate;
+};
+
 class MpvWidget : public QOpenGLWidget
 {
     Q_OBJECT
 public:
+    typedef std::function<void(QVariant)> Callback;
+
     explicit MpvWidget(QWidget *parent = 0, const QString &clientName = "mpv");
     ~MpvWidget();
-    QList<AudioDevice> audioDevices();
 
     void showMessage(QString message);
 
     void fileOpen(QString filename);
+    void setPreloadedFile(QString filename);
     void discFilesOpen(QString path);
     void stopPlayback();
     void stepBackward();
     void stepForward();
     void seek(double amount, bool exact);
-    void screenshot(const QString &fileName, bool subtitles);
     void setLogoUrl(const QString &filename);
     void setLoopImages(bool yes);
 
-    int64_t chapter();
-    bool setChapter(int64_t chapter);
-    QString mediaTitle();
     void setMute(bool yes);
     void setPaused(bool yes);
     void setSpeed(double speed);
@@ -48,9 +66,11 @@ public:
     void setSubtitleTrack(int64_t id);
     void setVideoTrack(int64_t id);
     void setDrawLogo(bool yes);
-    QString mpvVersion();
     void setVolume(int64_t volume);
-    bool eofReached();
+    int64_t chapter() const;
+    bool eofReached() const;
+    QString mediaTitle() const;
+    QString mpvVersion() const;
     void setSubsAreGray(bool yes);
     void setFramedropMode(QString mode);
     void setDecoderDropMode(QString mode);
@@ -60,11 +80,7 @@ public:
     void setMaximumVideoChange(double change);
     void setScreenshotFormat(QString format);
     void setScreenshotJpegQuality(int64_t value);
-    void setScreenshotJpegSmooth(int64_t value);
-    void setScreenshotJpegSourceChroma(bool yes);
     void setScreenshotPngCompression(int64_t value);
-    void setScreenshotPngFilter(int64_t value);
-    void setScreenshotPngColorspace(bool yes);
     void setClientDebuggingMessages(bool yes);
     void setMpvLogLevel(QString level);
 
@@ -74,10 +90,30 @@ public:
     QSize videoSize();
 
     void setCachedMpvOption(const QString &option, const QVariant &value);
-    QVariant blockingMpvCommand(QVariant params);
-    QVariant blockingSetMpvPropertyVariant(QString name, QVariant value);
-    QVariant blockingSetMpvOptionVariant(QString name, QVariant value);
-    QVariant getMpvPropertyVariant(QString name);
+
+    // These return straight away, and call back on the gui thread with the
+    // value or MpvErrorCode that mpv answered with.  The callback is dropped
+    // if the context object has been destroyed by then.  Properties in the
+    // mirror are answered from it before returning, unless they have been
+    // set since and mpv has not yet reported the change back.
+    void mpvCommandAsync(QVariant params, QObject *context,
+                         const Callback &callback);
+    void setMpvPropertyVariantAsync(QString name, QVariant value,
+                                    QObject *context, const Callback &callback);
+    void setMpvOptionVariantAsync(QString name, QVariant value,
+                                  QObject *context, const Callback &callback);
+    void getMpvPropertyVariantAsync(QString name, QObject *context,
+                                    const Callback &callback);
+    void getMpvPropertyStringAsync(QString name, QObject *context,
+                                   const Callback &callback);
+    // Calls back with the current frame as a QImage, or an MpvErrorCode.
+    void grabFrameAsync(bool subtitles, QObject *context,
+                        const Callback &callback);
+    // These call back with the MpvErrorCode of the change to observing.
+    void unobserveMpvPropertiesAsync(QSet<uint64_t> ids, QObject *context,
+                                     const Callback &callback);
+    void setMpvPropertyPolicyAsync(uint64_t id, int policy, int msec,
+                                   QObject *context, const Callback &callback);
 
 protected:
     void initializeGL();
@@ -86,6 +122,10 @@ protected:
 
 private:
     static void ctrl_update(void *ctx);
+    static MpvCallback *makeCallback(QObject *context, const Callback &callback);
+    void mirrorProperty(const QString &name, const QVariant &v);
+    void beginPropertySet(const QString &name);
+    void endPropertySet(const QString &name);
     void     setMpvPropertyVariant(QString name, QVariant value);
     void     setMpvOptionVariant(QString name, QVariant value);
 
@@ -106,8 +146,8 @@ signals:
     void mediaTitleChanged(QString title);
     void metaDataChanged(QVariantMap metadata);
     void chapterDataChanged(QVariantMap metadata);
-    void chaptersChanged(QVariantList chapters);
-    void tracksChanged(QVariantList tracks);
+    void chaptersChanged(MediaChapterList chapters);
+    void tracksChanged(MediaTrackList tracks);
     void videoSizeChanged(QSize size);
     void fpsChanged(double fps);
     void avsyncChanged(double sync);
@@ -121,7 +161,8 @@ signals:
 
 private slots:
     void maybeUpdate();
-    void ctrl_mpvPropertyChanged(QString name, QVariant v);
+    void ctrl_mpvPropertyChanged(QString name, QVariant v, uint64_t userData);
+    void ctrl_snapshotReady();
     void ctrl_logMessage(QString message);
     void ctrl_clientMessage(uint64_t id, const QStringList &args);
     void ctrl_unhandledMpvEvent(int eventLevel);
@@ -137,8 +178,15 @@ private slots:
 private:
     QThread *worker;
     MpvController *ctrl;
+    SnapshotBuffer *snapshots;
+    PlaybackSnapshot snapshot;
     mpv_opengl_cb_context *glMpv;
     QVariantMap cachedState;
+    // the last values seen of the properties observed for the gui
+    QHash<QString,QVariant> mirror;
+    // properties with a set in flight, and those whose mirror is behind one
+    QHash<QString,int> settingProperties;
+    QSet<QString> unmirrored;
 
     QSize videoSize_;
     double playTime_;
@@ -149,6 +197,7 @@ private:
     LogoDrawer *logo;
 
     bool loopImages;
+    QString preloadedFile;
 
     bool debugMessages;
 };
@@ -187,6 +236,25 @@ private:
 };
 
 
+// SnapshotBuffer passes PlaybackSnapshots from one writing thread to one
+// reading thread without locking.  Three buffers are rotated through an
+// atomic index, so that the writer and the reader never touch the same one
+// and the reader always gets the latest snapshot published.
+class SnapshotBuffer {
+public:
+    SnapshotBuffer();
+    void publish(const PlaybackSnapshot &snapshot);
+    bool take(PlaybackSnapshot &snapshot);
+
+private:
+    enum { IndexMask = 3, FreshBit = 4 };
+    PlaybackSnapshot buffers[3];
+    QAtomicInt middle;
+    int back;       // writer only
+    int front;      // reader only
+};
+
+
 // This controller attempts to shove as much libmpv related business off of
 // the main thread.
 class MpvController : public QObject
@@ -201,11 +269,32 @@ public:
             : name(name), userData(userData), format(format) {}
     };
     typedef QVector<MpvProperty> PropertyList;
+    // Ids of the properties observed for the gui.  They are kept well clear
+    // of the 32-bit ids that ipc clients choose for themselves.
+    enum PropertyId : uint64_t {
+        InternalIdBase = 0x4d50000000000000ull,
+        TimePosId, PauseId, MediaTitleId, ChapterMetadataId, TrackListId,
+        ChapterListId, DurationId, EstimatedVfFpsId, AvsyncId,
+        FrameDropCountId, DecoderFrameDropCountId, AudioBitrateId,
+        VideoBitrateId, PausedForCacheId, MetadataId, AudioDeviceListId,
+        ChapterId, EofReachedId, MpvVersionId,
+        InternalIdEnd
+    };
+    static bool isInternalId(uint64_t id);
     enum LogLevel { LogNone, LogFatal, LogError, LogWarn, LogInfo, LogV,
                     LogDebug, LogTrace, LogTerminalDefault };
+    // How changes of an observed property are passed on.  Immediate sends
+    // every change, OnChange drops repeats of the last value sent, Coalesce
+    // sends the latest value once per interval after a change, and MaxRate
+    // sends changes straight away but no more often than the interval.
+    enum ThrottlePolicy { Immediate, OnChange, Coalesce, MaxRate };
 
     MpvController(QObject *parent = 0);
     ~MpvController();
+    SnapshotBuffer *snapshotBuffer();
+    // for diagnostics: how often mpv woke us, and how many drains that took
+    int wakeupCount() const;
+    int drainCount() const;
 
 signals:
     void durationChanged(int value);
@@ -215,6 +304,9 @@ signals:
     void clientMessage(uint64_t id, QStringList args);
     void videoSizeChanged(QSize size);
     void unhandledMpvEvent(int eventNumber);
+    void snapshotReady();
+    void trackListChanged(MediaTrackList tracks);
+    void chapterListChanged(MediaChapterList chapters);
 
 public slots:
     void create(bool video = true, bool audio = true);
@@ -223,6 +315,8 @@ public slots:
                           const QSet<QString> &throttled = QSet<QString>());
     int unobservePropertiesById(const QSet<uint64_t> &ids);
     void setThrottleTime(int msec);
+    void setPropertyPolicy(const QString &name, int policy, int msec = 0);
+    int setPropertyPolicyById(uint64_t id, int policy, int msec = 0);
 
     QString clientName();
     int64_t timeMicroseconds();
@@ -237,26 +331,75 @@ public slots:
     QVariant getPropertyVariant(const QString &name);
     int setPropertyString(const QString &name, const QString &value);
     QString getPropertyString(const QString &name);
+    QVariant screenshotRaw(bool subtitles);
 
     void commandAsync(const QVariant &params, MpvCallback *callback);
     void setPropertyVariantAsync(const QString &name, const QVariant &value, MpvCallback *callback);
     void getPropertyVariantAsync(const QString &name, MpvCallback *callback);
+    void getPropertyStringAsync(const QString &name, MpvCallback *callback);
+    void setOptionVariantAsync(const QString &name, const QVariant &value, MpvCallback *callback);
+    void grabFrame(bool subtitles, MpvCallback *callback);
+    void unobservePropertiesByIdAsync(const QSet<uint64_t> &ids, MpvCallback *callback);
+    void setPropertyPolicyByIdAsync(uint64_t id, int policy, int msec, MpvCallback *callback);
 
     void parseMpvEvents();
 
 private:
-    void setThrottledProperty(const QString &name, const QVariant &v, uint64_t userData);
+    struct PropertyPolicy {
+        PropertyPolicy(ThrottlePolicy policy = Immediate, int interval = 0)
+            : policy(policy), interval(interval) {}
+        ThrottlePolicy policy;
+        int interval;   // zero takes the throttle time
+    };
+    struct PropertyState {
+        PropertyState() : lastSent(-1), due(-1), hasLastValue(false) {}
+        QString name;
+        QVariant lastValue;
+        QVariant pendingValue;
+        qint64 lastSent;
+        qint64 due;     // -1 while nothing is pending
+        bool hasLastValue;
+    };
+
+    PropertyPolicy policyOf(const QString &name, uint64_t userData) const;
+    void propertyChanged(const QString &name, const QVariant &v, uint64_t userData);
+    void scheduleFlush(qint64 due);
     void flushProperties();
+    bool updateSnapshot(uint64_t id, mpv_event_property *prop);
+    bool updateLists(uint64_t id, mpv_event_property *prop);
+    QVariant frameFromNode(const mpv_node *node);
     void handleMpvEvent(mpv_event *event);
+    void scheduleDrain();
     static void mpvWakeup(void *ctx);
 
     mpv::qt::Handle mpv;
     mpv_opengl_cb_context *glMpv;
     QSize lastVideoSize;
+    // reused for each grabbed frame once nobody else holds the last one
+    QImage frameBuffer;
+
+    // At most one parseMpvEvents is queued at a time, however often mpv
+    // wakes us up in the meantime.
+    QAtomicInt drainScheduled;
+    QAtomicInt wakeups;
+    QAtomicInt drains;
 
+    // The throttler is only armed while something is waiting to be sent, for
+    // the earliest time that it is due.
     QTimer *throttler;
-    QSet<QString> throttledProperties;
-    QMap<QString,QPair<QVariant,uint64_t>> throttledValues;
+    QElapsedTimer clock;
+    qint64 flushDue;
+    int throttleTime;
+    QHash<QString,PropertyPolicy> namePolicies;
+    QHash<uint64_t,PropertyPolicy> idPolicies;
+    QHash<uint64_t,PropertyState> propertyStates;
+    QSet<uint64_t> pendingIds;
+
+    // hot properties are gathered here, and published at most once per
+    // throttle time
+    PlaybackSnapshot snapshot;
+    SnapshotBuffer snapshots;
+    qint64 snapshotDue;
 };
 
 #endif // MPVWIDGET_H
@@ -1,9 +1,23 @@
 #include <QFileInfo>
-#include <QMutableListIterator>
+#include <QVector>
+#include <QtConcurrent>
 #include <cmath>
 #include "playlist.h"
 
-Item::Item(QUrl url)
+// Case fold text and strip it of accents, so that searching for "cafe" will
+// find "Café" and so on.
+static QString foldSearchText(const QString &text)
+{
+    QString decomposed = text.normalized(QString::NormalizationForm_KD).toCaseFolded();
+    QString folded;
+    folded.reserve(decomposed.size());
+    for (const QChar &c : decomposed)
+        if (c.category() != QChar::Mark_NonSpacing)
+            folded.append(c);
+    return folded;
+}
+
+Item::Item(QUrl url) : version_(0)
 {
     setUrl(url);
     setUuid(QUuid::createUuid());
@@ -12,6 +26,15 @@ Item::Item(QUrl url)
     setHidden(false);
 }
 
+Item::Item(const QUuid &uuid, const QUrl &url, const QVariantMap &metadata)
+    : uuid_(uuid), url_(url), metadata_(metadata), version_(0)
+{
+    setQueuePosition(0);
+    setExtraPlayTimes(0);
+    setHidden(false);
+    updateSearchKey();
+}
+
 QUuid Item::uuid() const
 {
     return uuid_;
@@ -40,6 +63,7 @@ QUrl Item::url() const
 void Item::setUrl(const QUrl &url)
 {
     url_ = url;
+    updateSearchKey();
 }
 
 QVariantMap Item::metadata() const
@@ -50,6 +74,7 @@ QVariantMap Item::metadata() const
 void Item::setMetadata(const QVariantMap &qvm)
 {
     metadata_ = qvm;
+    updateSearchKey();
 }
 
 int Item::queuePosition() const
@@ -105,6 +130,16 @@ QString Item::toDisplayString() const
     return url().toDisplayString(QUrl::FullyDecoded);
 }
 
+QString Item::searchKey() const
+{
+    return searchKey_;
+}
+
+int Item::version() const
+{
+    return version_;
+}
+
 QString Item::toString() const
 {
     return url_.isLocalFile() ? url_.toLocalFile() : url_.url();
@@ -130,6 +165,21 @@ void Item::fromVMap(const QVariantMap &qvm)
     url_ = qvm.contains("url") ? qvm.value("url").toUrl() : QUrl();
     uuid_ = qvm.contains("uuid") ? qvm.value("uuid").toUuid() : QUuid::createUuid();
     metadata_ = qvm.contains("metadata") ? qvm.value("metadata").toMap() : QVariantMap();
+    updateSearchKey();
+}
+
+void Item::updateSearchKey()
+{
+    // Called whenever what the item displays changes, so the version tells
+    // drawing code when its rendered text is out of date.
+    ++version_;
+
+    // The display string and each metadata value are kept on separate lines,
+    // which no needle can span.
+    QStringList parts({ toDisplayString() });
+    for (const QVariant &v : metadata_)
+        parts.append(v.toString());
+    searchKey_ = foldSearchText(parts.join('\n'));
 }
 
 QSharedPointer<ItemCollection> ItemCollection::collection;
@@ -198,22 +248,26 @@ Playlist::~Playlist()
 QSharedPointer<Item> Playlist::addItem(const QUrl &url)
 {
     QWriteLocker locker(&listLock);
+    bumpRevision();
     QSharedPointer<Item> i(ItemCollection::getSingleton()->addItem(url));
     i->setPlaylistUuid(uuid_);
-    items.append(i);
-    itemsByUuid.insert(i->uuid(), i);
+    itemsByUuid.insert(i->uuid(), items.insert(items.end(), i));
+    locker.unlock();
+    emit itemsInserted(uuid_, QUuid(), { i });
     return i;
 }
 
 QSharedPointer<Item> Playlist::addItem(const QUuid &uuid, const QUrl &url)
 {
     QWriteLocker locker(&listLock);
+    bumpRevision();
     QSharedPointer<Item> i(ItemCollection::getSingleton()->addItem(uuid, url));
     i->setPlaylistUuid(uuid_);
     i->setUrl(url);
     i->setUuid(uuid);
-    items.append(i);
-    itemsByUuid.insert(uuid, i);
+    itemsByUuid.insert(uuid, items.insert(items.end(), i));
+    locker.unlock();
+    emit itemsInserted(uuid_, QUuid(), { i });
     return i;
 }
 
@@ -221,49 +275,53 @@ QSharedPointer<Item> Playlist::addItemClone(const QSharedPointer<Item> &item)
 {
     QSharedPointer<Item> i = addItem(item->url());
     i->setPlaylistUuid(uuid_);
-    i->setMetadata(item->metadata());
+    setItemMetadata(i->uuid(), item->metadata());
     return i;
 }
 
 void Playlist::addItemRaw(const QSharedPointer<Item> &item)
 {
     QWriteLocker locker(&listLock);
-    items.append(item);
-    itemsByUuid.insert(item->uuid(), item);
+    bumpRevision();
+    itemsByUuid.insert(item->uuid(), items.insert(items.end(), item));
+    locker.unlock();
+    emit itemsInserted(uuid_, QUuid(), { item });
 }
 
 QSharedPointer<Item> Playlist::itemOf(const QUuid &uuid)
 {
     QReadLocker locker(&listLock);
-    return itemsByUuid.value(uuid, QSharedPointer<Item>());
+    auto position = itemsByUuid.constFind(uuid);
+    if (position == itemsByUuid.constEnd())
+        return QSharedPointer<Item>();
+    return *position.value();
 }
 
 QSharedPointer<Item> Playlist::itemAfter(const QUuid &uuid)
 {
     QReadLocker locker(&listLock);
-    if (!itemsByUuid.contains(uuid))
+    auto position = itemsByUuid.constFind(uuid);
+    if (position == itemsByUuid.constEnd())
         return QSharedPointer<Item>();
-    int index = items.indexOf(itemsByUuid[uuid]);
-    if (index < 0 || index + 1 >= items.length())
+    ItemList::iterator next = std::next(position.value());
+    if (next == items.end())
         return QSharedPointer<Item>();
-    return items[index + 1];
+    return *next;
 }
 
 QSharedPointer<Item> Playlist::itemBefore(const QUuid &uuid)
 {
     QReadLocker locker(&listLock);
-    if (!itemsByUuid.contains(uuid))
-        return QSharedPointer<Item>();
-    int index = items.indexOf(itemsByUuid[uuid]);
-    if (index <= 0)
+    auto position = itemsByUuid.constFind(uuid);
+    if (position == itemsByUuid.constEnd() || position.value() == items.begin())
         return QSharedPointer<Item>();
-    return items[index - 1];
+    return *std::prev(position.value());
 }
 
 bool Playlist::isEmpty()
 {
     QReadLocker lock(&listLock);
-    return items.isEmpty();
+    return items.empty();
 }
 
 bool Playlist::contains(const QUuid &uuid)
@@ -279,28 +337,109 @@ void Playlist::iterateItems(const std::function<void(QSharedPointer<Item>)> &cal
         callback(item);
 }
 
+void Playlist::readItems(const QList<QSharedPointer<Item>> &items,
+                         const std::function<void(QSharedPointer<Item>)> &callback)
+{
+    // For looking at items taken earlier from the list on another thread,
+    // while their urls and metadata are not being changed
+    QReadLocker locker(&listLock);
+    for (auto item : items)
+        callback(item);
+}
+
+QList<QSharedPointer<Item>> Playlist::snapshot()
+{
+    // A copy of the item pointers, for walking the list without the lock
+    QReadLocker locker(&listLock);
+    QList<QSharedPointer<Item>> list;
+    list.reserve(int(items.size()));
+    for (auto item : items)
+        list.append(item);
+    return list;
+}
+
+QVector<QString> Playlist::searchKeys(const QList<QSharedPointer<Item>> &items)
+{
+    // Copies of the keys, taken under the lock that their writers hold, so
+    // that the searcher's threads never read an item as it is changed
+    QReadLocker locker(&listLock);
+    QVector<QString> keys;
+    keys.reserve(items.count());
+    for (const QSharedPointer<Item> &item : items)
+        keys.append(item->searchKey());
+    return keys;
+}
+
+int Playlist::revision()
+{
+    return revision_.load();
+}
+
+int Playlist::keyRevision()
+{
+    return keyRevision_.load();
+}
+
+void Playlist::bumpRevision()
+{
+    // Most changes are made with the list locked, so the news is posted to
+    // be sent once it is let go.
+    ++revision_;
+    if (revisedPending.testAndSetOrdered(0, 1))
+        QMetaObject::invokeMethod(this, "self_revised", Qt::QueuedConnection);
+}
+
+void Playlist::self_revised()
+{
+    revisedPending.store(0);
+    emit revised(uuid_);
+}
+
 void Playlist::addItems(const QUuid &where,
                         const QList<QSharedPointer<Item>> &itemsToAdd)
 {
     QWriteLocker locker(&listLock);
+    bumpRevision();
 
-    int indexWhere = items.indexOf(itemsByUuid[where]);
-    if (indexWhere < 0)
-        indexWhere = items.size();
-    for (int i = 0; i < itemsToAdd.count(); ++i) {
-        QSharedPointer<Item> item = itemsToAdd.at(i);
+    // Insert before the item at where, or at the end if there is no such item
+    ItemList::iterator position = itemsByUuid.value(where, items.end());
+    QUuid before = position == items.end() ? QUuid() : where;
+    for (QSharedPointer<Item> item : itemsToAdd) {
         item->setPlaylistUuid(uuid_);
-        items.insert(indexWhere + i, item);
-        itemsByUuid.insert(item->uuid(), item);
+        itemsByUuid.insert(item->uuid(), items.insert(position, item));
     }
+    locker.unlock();
+    emit itemsInserted(uuid_, before, itemsToAdd);
 }
 
 void Playlist::removeItem(const QUuid &uuid)
 {
     QWriteLocker locker(&listLock);
+    bumpRevision();
     PlaylistCollection::getSingleton()->queuePlaylist()->removeItem(uuid);
-    items.removeAll(itemsByUuid.take(uuid));
+    if (itemsByUuid.contains(uuid))
+        items.erase(itemsByUuid.take(uuid));
     ItemCollection::getSingleton()->removeItem(uuid);
+    locker.unlock();
+    emit itemsRemoved(uuid_, { uuid });
+}
+
+void Playlist::removeItems(const QList<QUuid> &itemsToRemove)
+{
+    QWriteLocker locker(&listLock);
+    bumpRevision();
+    PlaylistCollection::getSingleton()->queuePlaylist()->removeItems(itemsToRemove);
+    auto collection = ItemCollection::getSingleton();
+    for (const QUuid &uuid : itemsToRemove) {
+        auto position = itemsByUuid.find(uuid);
+        if (position == itemsByUuid.end())
+            continue;
+        items.erase(position.value());
+        itemsByUuid.erase(position);
+        collection->removeItem(uuid);
+    }
+    locker.unlock();
+    emit itemsRemoved(uuid_, itemsToRemove);
 }
 
 void Playlist::takeItemsRaw(const QList<QSharedPointer<Item>> &itemsToRemove)
@@ -308,39 +447,65 @@ void Playlist::takeItemsRaw(const QList<QSharedPointer<Item>> &itemsToRemove)
     // "takeItemsRaw", because we don't check if it's in a queue or whatever,
     // it's just taken raw, potentially damaging everything.  Only use if you
     // may know what you're doing.
+    bumpRevision();
+    QList<QUuid> taken;
     for (QSharedPointer<Item> item: itemsToRemove) {
-        itemsByUuid.remove(item->uuid());
-        items.removeAll(item);
+        if (itemsByUuid.contains(item->uuid()))
+            items.erase(itemsByUuid.take(item->uuid()));
+        taken.append(item->uuid());
     }
+    emit itemsRemoved(uuid_, taken);
 }
 
 QList<QUuid> Playlist::replaceItem(const QUuid &where, const QList<QUrl> &urls)
 {
     QWriteLocker lock(&listLock);
+    bumpRevision();
     if (!itemsByUuid.contains(where))
         return QList<QUuid>();
 
-    itemsByUuid[where]->setUrl(urls[0]);
+    ItemList::iterator position = itemsByUuid.value(where);
+    (*position)->setUrl(urls[0]);
 
     QList<QUuid> addedItems;
+    QList<QSharedPointer<Item>> changedItems({ *position });
     // essentially insertAfter(where, urls[1..end]);
-    int insertIndex = items.indexOf(itemsByUuid[where]);
+    ++position;
+    QUuid before = position == items.end() ? QUuid() : (*position)->uuid();
     for (int urlIndex = 1; urlIndex < urls.count(); urlIndex++) {
         QSharedPointer<Item> i(new Item(urls[urlIndex]));
         i->setPlaylistUuid(uuid_);
-        items.insert(insertIndex + urlIndex, i);
-        itemsByUuid.insert(i->uuid(), i);
+        itemsByUuid.insert(i->uuid(), items.insert(position, i));
         addedItems.append(i->uuid());
+        changedItems.append(i);
     }
+    lock.unlock();
+    emit itemsInserted(uuid_, before, changedItems);
     return addedItems;
 }
 
+void Playlist::setItemMetadata(const QUuid &uuid, const QVariantMap &metadata)
+{
+    QWriteLocker locker(&listLock);
+    auto position = itemsByUuid.constFind(uuid);
+    if (position == itemsByUuid.constEnd())
+        return;
+    QSharedPointer<Item> item = *position.value();
+    item->setMetadata(metadata);
+    keyRevision_.ref();
+    locker.unlock();
+    emit itemChanged(uuid_, item);
+}
+
 void Playlist::clear()
 {
     QWriteLocker locker(&listLock);
+    bumpRevision();
     PlaylistCollection::getSingleton()->queuePlaylist()->removeItems(itemsByUuid.keys());
     items.clear();
     itemsByUuid.clear();
+    locker.unlock();
+    emit cleared(uuid_);
 }
 
 QString Playlist::title()
@@ -353,6 +518,8 @@ void Playlist::setTitle(const QString &title)
 {
     QWriteLocker locker(&listLock);
     title_ = title;
+    locker.unlock();
+    emit titleChanged(uuid_, title);
 }
 
 QUuid Playlist::uuid()
@@ -379,15 +546,20 @@ QStringList Playlist::toStringList()
 void Playlist::fromStringList(QStringList sl)
 {
     QWriteLocker locker(&listLock);
+    bumpRevision();
     items.clear();
     itemsByUuid.clear();
+    QList<QSharedPointer<Item>> added;
     for (QString s : sl) {
         QSharedPointer<Item> item(new Item());
         item->setPlaylistUuid(uuid_);
         item->fromString(s);
-        items.append(item);
-        itemsByUuid.insert(item->uuid(), item);
+        itemsByUuid.insert(item->uuid(), items.insert(items.end(), item));
+        added.append(item);
     }
+    locker.unlock();
+    emit cleared(uuid_);
+    emit itemsInserted(uuid_, QUuid(), added);
 }
 
 QVariantMap Playlist::toVMap()
@@ -408,6 +580,7 @@ QVariantMap Playlist::toVMap()
 void Playlist::fromVMap(const QVariantMap &qvm)
 {
     QReadLocker locker(&listLock);
+    bumpRevision();
     title_ = qvm.contains("title") ? qvm["title"].toString() : QString();
     uuid_ = qvm.contains("uuid") ? qvm["uuid"].toUuid() : QUuid::createUuid();
     if (qvm.contains("items")) {
@@ -416,8 +589,8 @@ void Playlist::fromVMap(const QVariantMap &qvm)
             QSharedPointer<Item> i(new Item());
             i->setPlaylistUuid(uuid_);
             i->fromVMap(v.toMap());
-            this->items.append(i);
-            this->itemsByUuid.insert(i->uuid(), i);
+            this->itemsByUuid.insert(i->uuid(),
+                                     this->items.insert(this->items.end(), i));
             ItemCollection::getSingleton()->storeItem(i);
         }
     }
@@ -434,22 +607,23 @@ QueuePlaylist::QueuePlaylist(const QString &title)
 QPair<QUuid,QUuid> QueuePlaylist::first()
 {
     QReadLocker lock(&listLock);
-    if (items.isEmpty())
+    if (items.empty())
         return QPair<QUuid,QUuid>(QUuid(),QUuid());
-    return { items.first()->playlistUuid(), items.first()->uuid() };
+    return { items.front()->playlistUuid(), items.front()->uuid() };
 }
 
 QPair<QUuid,QUuid> QueuePlaylist::takeFirst()
 {
     QWriteLocker lock(&listLock);
-    if (items.isEmpty())
+    bumpRevision();
+    if (items.empty())
         return { QUuid(), QUuid() };
-    QSharedPointer<Item> item = items.takeFirst();
+    QSharedPointer<Item> item = items.front();
+    items.pop_front();
     itemsByUuid.remove(item->uuid());
     item->setQueuePosition(0);
-    int i = 1;
     for (auto item : items)
-        item->setQueuePosition(i++);
+        item->decQueuePosition();
     return { item->playlistUuid(), item->uuid() };
 
 }
@@ -457,12 +631,14 @@ QPair<QUuid,QUuid> QueuePlaylist::takeFirst()
 int QueuePlaylist::toggle(const QUuid &playlistUuid, const QUuid &itemUuid, bool always)
 {
     QWriteLocker lock(&listLock);
+    bumpRevision();
     return toggle_(playlistUuid, itemUuid, always);
 }
 
 void QueuePlaylist::toggle(const QUuid &playlistUuid, const QList<QUuid> &uuids, QList<QUuid> &added, QList<int> &removed)
 {
     QWriteLocker lock(&listLock);
+    bumpRevision();
     int numberPresent = contains_(uuids);
     if (numberPresent == uuids.count()) {
         removed.append(removeItems_(uuids));
@@ -476,6 +652,7 @@ void QueuePlaylist::toggle(const QUuid &playlistUuid, const QList<QUuid> &uuids,
 void QueuePlaylist::toggleFromPlaylist(const QUuid &playlistUuid, QList<QUuid> &added, QList<int> &removedIndices)
 {
     QWriteLocker lock(&listLock);
+    bumpRevision();
     auto pl = PlaylistCollection::getSingleton()->playlistOf(playlistUuid);
     QReadLocker plLock(&pl->listLock);
     if (contains_(pl->itemsByUuid.keys()) == pl->itemsByUuid.count()) {
@@ -484,9 +661,8 @@ void QueuePlaylist::toggleFromPlaylist(const QUuid &playlistUuid, QList<QUuid> &
     } else {
         for (QSharedPointer<Item> &item : pl->items) {
             if (!itemsByUuid.contains(item->uuid())) {
-                items.append(item);
-                itemsByUuid.insert(item->uuid(), item);
-                item->setQueuePosition(items.count());
+                itemsByUuid.insert(item->uuid(), items.insert(items.end(), item));
+                item->setQueuePosition(int(items.size()));
                 added.append(item->uuid());
             }
         }
@@ -496,6 +672,7 @@ void QueuePlaylist::toggleFromPlaylist(const QUuid &playlistUuid, QList<QUuid> &
 void QueuePlaylist::appendItems(const QUuid &playlistUuid, const QList<QUuid> &itemsToAdd)
 {
     QWriteLocker lock(&listLock);
+    bumpRevision();
     for (QUuid item : itemsToAdd)
         toggle_(playlistUuid, item, true);
 }
@@ -503,36 +680,40 @@ void QueuePlaylist::appendItems(const QUuid &playlistUuid, const QList<QUuid> &i
 void QueuePlaylist::addItems(const QUuid &where, const QList<QSharedPointer<Item> > &itemsToAdd)
 {
     QWriteLocker lock(&listLock);
-    int index = items.indexOf(itemsByUuid[where]);
-    if (index < 0)
-        index = 0;
-
-    int count = itemsToAdd.count();
-    for (int i = 0; i < count; i++) {
-        QSharedPointer<Item> item = itemsToAdd[i];
-        items.insert(index + i, item);
-        itemsByUuid.insert(item->uuid(), item);
-    }
-    count = items.count();
-    for (int i = index; i < count; i++)
-        items[i]->setQueuePosition(i+1);
+    bumpRevision();
+    // Insert before the item at where, or at the front if there is no such
+    // item.
+    ItemList::iterator position = itemsByUuid.value(where, items.begin());
+    if (itemsToAdd.isEmpty())
+        return;
+
+    for (QSharedPointer<Item> item : itemsToAdd)
+        itemsByUuid.insert(item->uuid(), items.insert(position, item));
+    // Number from the head, as the queue may have been taken from raw
+    // beforehand (such as when dragging within it) and left with gaps.
+    int index = 0;
+    for (QSharedPointer<Item> &item : items)
+        item->setQueuePosition(++index);
 }
 
 void QueuePlaylist::removeItem(const QUuid &uuid)
 {
     QWriteLocker lock(&listLock);
+    bumpRevision();
     removeItem_(uuid);
 }
 
 void QueuePlaylist::removeItems(const QList<QUuid> &itemsToRemove)
 {
     QWriteLocker lock(&listLock);
+    bumpRevision();
     removeItems_(itemsToRemove);
 }
 
 void QueuePlaylist::clear()
 {
     QWriteLocker lock(&listLock);
+    bumpRevision();
     for (QSharedPointer<Item> item : items)
         item->setQueuePosition(0);
     items.clear();
@@ -560,9 +741,8 @@ int QueuePlaylist::toggle_(const QUuid &playlistUuid, const QUuid &itemUuid, boo
     QSharedPointer<Item> item = pl->itemOf(itemUuid);
     if (!item)
         return 0;
-    items.append(item);
-    itemsByUuid.insert(itemUuid, item);
-    item->setQueuePosition(items.count());
+    itemsByUuid.insert(itemUuid, items.insert(items.end(), item));
+    item->setQueuePosition(int(items.size()));
     return 1;
 }
 
@@ -579,34 +759,33 @@ void QueuePlaylist::removeItem_(const QUuid &uuid)
 {
     if (!itemsByUuid.contains(uuid))
         return;
-    QSharedPointer<Item> item = itemsByUuid[uuid];
-    int index = items.indexOf(item);
-    items.removeOne(item);
-    itemsByUuid.remove(uuid);
-    item->setQueuePosition(0);
-    int count = items.count();
-    for (int i = index; i < count; i++)
-        items[i]->setQueuePosition(i+1);
+    ItemList::iterator position = itemsByUuid.take(uuid);
+    (*position)->setQueuePosition(0);
+    // Everything after the removed item moves up by one
+    for (position = items.erase(position); position != items.end(); ++position)
+        (*position)->decQueuePosition();
 }
 
 QList<int> QueuePlaylist::removeItems_(const QList<QUuid> &itemsToRemove)
 {
     QList<int> removedIndices;
     QSet<QUuid> removalSet(itemsToRemove.toSet());
-    QMutableListIterator<QSharedPointer<Item>> i(items);
+    ItemList::iterator i = items.begin();
     int index = 0;
-    while (i.hasNext()) {
-        QSharedPointer<Item> item = i.next();
+    int position = 0;
+    while (i != items.end()) {
+        QSharedPointer<Item> item = *i;
         if (removalSet.contains(item->uuid())) {
             itemsByUuid.remove(item->uuid());
             item->setQueuePosition(0);
-            i.remove();
+            i = items.erase(i);
             removedIndices.append(index);
+        } else {
+            item->setQueuePosition(++position);
+            ++i;
         }
         index++;
     }
-    for (int i = 0; i < items.count(); i++)
-        items[i]->setQueuePosition(i+1);
     return removedIndices;
 }
 
@@ -658,6 +837,8 @@ void PlaylistCollection::removePlaylist(const QUuid &uuid)
     QSharedPointer<Playlist> p = playlistsByUuid.value(uuid);
     playlists.removeAll(p);
     playlistsByUuid.remove(uuid);
+    disconnect(p.data(), 0, this, 0);
+    emit playlistRemoved(uuid);
 }
 
 void PlaylistCollection::removePlaylist(const QSharedPointer<Playlist> &p)
@@ -690,9 +871,12 @@ void PlaylistCollection::addPlaylist(const QSharedPointer<Playlist> &playlist)
         QSharedPointer<Playlist> old = playlistsByUuid[playlist->uuid()];
         playlistsByUuid.remove(playlist->uuid());
         playlists.removeOne(old);
+        disconnect(old.data(), 0, this, 0);
     }
     playlists.append(playlist);
     playlistsByUuid.insert(playlist->uuid(), playlist);
+    watchPlaylist(playlist);
+    emit playlistAdded(playlist);
 }
 
 QSharedPointer<Playlist> PlaylistCollection::doNewPlaylist(const QString &title,
@@ -702,47 +886,52 @@ QSharedPointer<Playlist> PlaylistCollection::doNewPlaylist(const QString &title,
     p->setUuid(uuid);
     playlists.append(p);
     playlistsByUuid.insert(p->uuid(), p);
+    watchPlaylist(p);
+    emit playlistAdded(p);
     return p;
 }
 
-void PlaylistSearcher::bump()
+void PlaylistCollection::watchPlaylist(const QSharedPointer<Playlist> &playlist)
 {
-    QWriteLocker locker(&bumpLock);
-    ++bumps_;
+    connect(playlist.data(), &Playlist::itemsInserted,
+            this, &PlaylistCollection::itemsInserted);
+    connect(playlist.data(), &Playlist::itemsRemoved,
+            this, &PlaylistCollection::itemsRemoved);
+    connect(playlist.data(), &Playlist::itemChanged,
+            this, &PlaylistCollection::itemChanged);
+    connect(playlist.data(), &Playlist::cleared,
+            this, &PlaylistCollection::playlistCleared);
+    connect(playlist.data(), &Playlist::titleChanged,
+            this, &PlaylistCollection::titleChanged);
+    connect(playlist.data(), &Playlist::revised,
+            this, &PlaylistCollection::playlistRevised);
 }
 
-void PlaylistSearcher::unbump()
+int PlaylistSearcher::nextGeneration()
 {
-    QWriteLocker locker(&bumpLock);
-    --bumps_;
+    return generation_.fetchAndAddOrdered(1) + 1;
 }
 
-int PlaylistSearcher::bumps()
+bool PlaylistSearcher::isStale(int generation) const
 {
-    QReadLocker locker(&bumpLock);
-    return bumps_;
+    return generation != generation_.load();
 }
 
-bool PlaylistSearcher::itemMatchesFilter(const QSharedPointer<Item> &item,
+bool PlaylistSearcher::itemMatchesFilter(const QString &haystack,
                                          const QStringList &needles)
 {
-    QSet<QString> found;
-    findNeedles(item->toDisplayString(), needles, found);
-    if (found.count() == needles.count())
-        return true;
-
-    // OPTIMIZE: don't run the metadata through toLower every search
-    for (const QVariant &v : item->metadata())
-        findNeedles(v.toString(), needles, found);
-    return found.count() == needles.count();
+    for (const QString &needle : needles) {
+        if (!haystack.contains(needle))
+            return false;
+    }
+    return true;
 }
 
-void PlaylistSearcher::filterPlaylist(QSharedPointer<Playlist> list, QString text)
+void PlaylistSearcher::filterPlaylist(QSharedPointer<Playlist> list, QString text,
+                                      int generation)
 {
-    // Limit response - only reply if last in event queue
-    bool bumpLimited = bumps() > 1;
-    unbump();
-    if (bumpLimited)
+    // Don't bother with requests that have already been superseded
+    if (isStale(generation))
         return;
 
     QStringList needles = textToNeedles(text);
@@ -754,10 +943,32 @@ void PlaylistSearcher::filterPlaylist(QSharedPointer<Playlist> list, QString tex
     if (list.isNull())
         return;
 
-    auto marker = [&needles](QSharedPointer<Item> item) {
-        item->setHidden(!itemMatchesFilter(item, needles));
-    };
-    list->iterateItems(marker);
+    // When the playlist and its items are untouched since the last search and
+    // the new query can only match fewer items, only last time's matches need
+    // to be looked at again.  Everything else is already hidden.
+    int revision = list->revision();
+    int keyRevision = list->keyRevision();
+    bool refine = list->uuid() == lastPlaylist && revision == lastRevision
+            && keyRevision == lastKeyRevision
+            && needlesNarrow(lastNeedles, needles);
+
+    QList<QSharedPointer<Item>> items = refine ? lastMatches : list->snapshot();
+    bool stale = false;
+    QList<QSharedPointer<Item>> matches =
+            markItems(items, list->searchKeys(items), needles, generation,
+                      stale);
+    if (stale) {
+        // The items are now only partly marked, so the next search must
+        // start over from the whole list.
+        forgetFilter();
+        return;
+    }
+
+    lastMatches = matches;
+    lastPlaylist = list->uuid();
+    lastRevision = revision;
+    lastKeyRevision = keyRevision;
+    lastNeedles = needles;
     emit playlistFiltered(list->uuid());
 }
 
@@ -766,6 +977,7 @@ void PlaylistSearcher::clearPlaylistFilter(QSharedPointer<Playlist> &list)
     if (list.isNull())
         return;
 
+    forgetFilter();
     auto clearer = [](QSharedPointer<Item> item) {
         item->setHidden(false);
     };
@@ -773,18 +985,76 @@ void PlaylistSearcher::clearPlaylistFilter(QSharedPointer<Playlist> &list)
     emit playlistFiltered(list->uuid());
 }
 
-QStringList PlaylistSearcher::textToNeedles(QString text)
+QList<QSharedPointer<Item>> PlaylistSearcher::markItems(const QList<QSharedPointer<Item>> &items,
+                                                        const QVector<QString> &keys,
+                                                        const QStringList &needles,
+                                                        int generation, bool &stale) const
+{
+    // Split the list into chunks and mark each of them on the thread pool.
+    // Every chunk collects its own matches, which are then joined in order.
+    // The chunks are small enough that checking for a newer request between
+    // them lets a stale scan stop almost immediately.
+    static const int chunkSize = 1024;
+    struct Chunk {
+        int begin;
+        int end;
+        QList<QSharedPointer<Item>> matches;
+    };
+    QVector<Chunk> chunks;
+    for (int begin = 0; begin < items.count(); begin += chunkSize)
+        chunks.append({ begin, std::min(begin + chunkSize, items.count()), {} });
+
+    auto marker = [this, &items, &keys, &needles, generation](Chunk &chunk) {
+        if (isStale(generation))
+            return;
+        for (int i = chunk.begin; i < chunk.end; i++) {
+            const QSharedPointer<Item> &item = items.at(i);
+            bool matches = itemMatchesFilter(keys.at(i), needles);
+            item->setHidden(!matches);
+            if (matches)
+                chunk.matches.append(item);
+        }
+    };
+    QtConcurrent::blockingMap(chunks, marker);
+
+    stale = isStale(generation);
+    QList<QSharedPointer<Item>> matches;
+    if (stale)
+        return matches;
+    for (const Chunk &chunk : chunks)
+        matches.append(chunk.matches);
+    return matches;
+}
+
+bool PlaylistSearcher::needlesNarrow(const QStringList &before,
+                                     const QStringList &after)
+{
+    // Anything matching after also matches before, if every old needle is
+    // found within one of the new ones.
+    if (before.isEmpty())
+        return false;
+    for (const QString &old : before) {
+        bool covered = false;
+        for (const QString &needle : after) {
+            if (needle.contains(old)) {
+                covered = true;
+                break;
+            }
+        }
+        if (!covered)
+            return false;
+    }
+    return true;
+}
+
+void PlaylistSearcher::forgetFilter()
 {
-    return text.toLower().split(QString(" "), QString::SkipEmptyParts);
+    lastPlaylist = QUuid();
+    lastNeedles.clear();
+    lastMatches.clear();
 }
 
-void PlaylistSearcher::findNeedles(const QString &text,
-                                   const QStringList &needles,
-                                   QSet<QString> &found)
+QStringList PlaylistSearcher::textToNeedles(QString text)
 {
-    QString haystack = text.toLower();
-    for (const QString &needle : needles) {
-        if (haystack.contains(needle))
-            found.insert(needle);
-    }
+    return foldSearchText(text).split(QString(" "), QString::SkipEmptyParts);
 }
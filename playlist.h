@@ -7,17 +7,21 @@
 #include <QUrl>
 #include <QObject>
 #include <functional>
+#include <list>
 #include <QSharedPointer>
 #include <QList>
+#include <QVector>
 #include <QSet>
 #include <QHash>
 #include <QStringList>
 #include <QVariantMap>
 #include <QReadWriteLock>
+#include <QAtomicInt>
 
 class Item {
 public:
     Item(QUrl url = QUrl());
+    Item(const QUuid &uuid, const QUrl &url, const QVariantMap &metadata);
 
     QUuid uuid() const;
     void setUuid(const QUuid &uuid);
@@ -41,6 +45,10 @@ public:
     bool hidden();
 
     QString toDisplayString() const;
+    // Only changed on the gui thread with the item's playlist write-locked,
+    // so other threads must read it with that playlist locked.
+    QString searchKey() const;
+    int version() const;
     QString toString() const;
     void fromString(QString input);
 
@@ -48,10 +56,14 @@ public:
     void fromVMap(const QVariantMap &qvm);
 
 private:
+    void updateSearchKey();
+
     QUuid uuid_;
     QUuid playlistUuid_;
     QUrl url_;
     QVariantMap metadata_;
+    QString searchKey_;
+    int version_;
     int queuePosition_;
     int extraPlayTimes_;
     bool hidden_;
@@ -95,10 +107,18 @@ public:
     bool isEmpty();
     bool contains(const QUuid &uuid);
     void iterateItems(const std::function<void(QSharedPointer<Item>)> &callback);
+    void readItems(const QList<QSharedPointer<Item>> &items,
+                   const std::function<void(QSharedPointer<Item>)> &callback);
+    QList<QSharedPointer<Item>> snapshot();
+    QVector<QString> searchKeys(const QList<QSharedPointer<Item>> &items);
+    int revision();
+    int keyRevision();
     virtual void addItems(const QUuid &where, const QList<QSharedPointer<Item> > &itemsToAdd);
     virtual void removeItem(const QUuid &uuid);
+    virtual void removeItems(const QList<QUuid> &itemsToRemove);
     void takeItemsRaw(const QList<QSharedPointer<Item>> &itemsToRemove);
     QList<QUuid> replaceItem(const QUuid &where, const QList<QUrl> &urls);
+    void setItemMetadata(const QUuid &uuid, const QVariantMap &metadata);
     virtual void clear();
 
     QString title();
@@ -112,15 +132,43 @@ public:
     QVariantMap toVMap();
     void fromVMap(const QVariantMap &qvm);
 
+signals:
+    // These are emitted after the change has been made and the list is
+    // unlocked again.  before is null when items were added to the end.
+    void itemsInserted(QUuid playlist, QUuid before, QList<QSharedPointer<Item>> items);
+    void itemsRemoved(QUuid playlist, QList<QUuid> items);
+    void itemChanged(QUuid playlist, QSharedPointer<Item> item);
+    void cleared(QUuid playlist);
+    void titleChanged(QUuid playlist, QString title);
+    // This is emitted from the event loop after the list is unlocked, once
+    // for however many changes were made in the meantime.
+    void revised(QUuid playlist);
+
+protected:
+    void bumpRevision();
+
+private slots:
+    void self_revised();
 
 protected:
-    QList<QSharedPointer<Item>> items;
-    QHash<QUuid, QSharedPointer<Item>> itemsByUuid;
+
+    // Items are kept in a linked list so that insertion and removal do not
+    // shift the rest of the list, and the hash keeps an iterator into it so
+    // that neighbour lookups don't need to search for the item first.
+    typedef std::list<QSharedPointer<Item>> ItemList;
+    ItemList items;
+    QHash<QUuid, ItemList::iterator> itemsByUuid;
     //QList<QUuid> queue;
     QString title_;
     QUuid uuid_;
 
     QReadWriteLock listLock;
+    // Bumped whenever the list is changed, so that cached results derived
+    // from it can tell when they have gone stale.
+    QAtomicInt revision_;
+    QAtomicInt revisedPending;
+    // Bumped whenever an item's search key is changed in place.
+    QAtomicInt keyRevision_;
 
     friend class QueuePlaylist;
 };
@@ -168,7 +216,20 @@ public:
 
     void addPlaylist(const QSharedPointer<Playlist> &playlist);
 
+signals:
+    // The changes of every playlist in the collection are passed on here
+    void playlistAdded(QSharedPointer<Playlist> playlist);
+    void playlistRemoved(QUuid playlist);
+    void itemsInserted(QUuid playlist, QUuid before, QList<QSharedPointer<Item>> items);
+    void itemsRemoved(QUuid playlist, QList<QUuid> items);
+    void itemChanged(QUuid playlist, QSharedPointer<Item> item);
+    void playlistCleared(QUuid playlist);
+    void titleChanged(QUuid playlist, QString title);
+    void playlistRevised(QUuid playlist);
+
 private:
+    void watchPlaylist(const QSharedPointer<Playlist> &playlist);
+
     QList<QSharedPointer<Playlist>> playlists;
     QHash<QUuid, QSharedPointer<Playlist>> playlistsByUuid;
     QSharedPointer<QueuePlaylist> queuePlaylist_;
@@ -181,28 +242,40 @@ class PlaylistSearcher : public QObject {
     Q_OBJECT
 public:
 
-    PlaylistSearcher() : QObject(), bumps_(0) {}
-    void bump();
-    void unbump();
-    int bumps();
+    PlaylistSearcher() : QObject(), generation_(0), lastRevision(0), lastKeyRevision(0) {}
+    int nextGeneration();
 
     static QStringList textToNeedles(QString text);
-    static bool itemMatchesFilter(const QSharedPointer<Item> &item,
+    static bool itemMatchesFilter(const QString &haystack,
                                   const QStringList &needles);
 
 signals:
     void playlistFiltered(QUuid playlist);
 
 public slots:
-    void filterPlaylist(QSharedPointer<Playlist> list, QString text);
+    void filterPlaylist(QSharedPointer<Playlist> list, QString text, int generation);
     void clearPlaylistFilter(QSharedPointer<Playlist> &list);
 
 private:
-    static void findNeedles(const QString &text, const QStringList &needles,
-                            QSet<QString> &found);
-
-    QReadWriteLock bumpLock;
-    volatile int bumps_;
+    bool isStale(int generation) const;
+    QList<QSharedPointer<Item>> markItems(const QList<QSharedPointer<Item>> &items,
+                                          const QVector<QString> &keys,
+                                          const QStringList &needles,
+                                          int generation, bool &stale) const;
+    static bool needlesNarrow(const QStringList &before, const QStringList &after);
+    void forgetFilter();
+
+    // Every filter request is tagged with a generation, and a scan gives up
+    // as soon as a newer request has been made.
+    QAtomicInt generation_;
+
+    // The last filter applied, so that a query which only grows can be
+    // refined from the items that matched last time.
+    QUuid lastPlaylist;
+    int lastRevision;
+    int lastKeyRevision;
+    QStringList lastNeedles;
+    QList<QSharedPointer<Item>> lastMatches;
 };
 
 
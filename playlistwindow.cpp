@@ -48,10 +48,23 @@ void PlaylistWindow::clearPlaylist(QUuid what)
         widgets[what]->removeAll();
 }
 
+QUuid PlaylistWindow::currentPlaylistUuid()
+{
+    auto qdp = currentPlaylistWidget();
+    return qdp ? qdp->uuid() : QUuid();
+}
+
 QPair<QUuid, QUuid> PlaylistWindow::addToCurrentPlaylist(QList<QUrl> what)
+{
+    return addToPlaylist(currentPlaylistUuid(), what);
+}
+
+QPair<QUuid, QUuid> PlaylistWindow::addToPlaylist(QUuid list, QList<QUrl> what)
 {
     QPair<QUuid, QUuid> info;
-    auto qdp = currentPlaylistWidget();
+    auto qdp = widgets.value(list);
+    if (!qdp)
+        return info;
     for (QUrl url : what) {
         QPair<QUuid,QUuid> itemInfo = qdp->importUrl(url);
         if (info.second.isNull())
@@ -90,6 +103,31 @@ QPair<QUuid,QUuid> PlaylistWindow::getItemAfter(QUuid list, QUuid item)
     return { pl->uuid(), after->uuid() };
 }
 
+QPair<QUuid,QUuid> PlaylistWindow::peekItemAfter(QUuid list, QUuid item)
+{
+    // As getItemAfter, but leaves the queue alone
+    auto pl = PlaylistCollection::getSingleton()->playlistOf(list);
+    if (!pl)
+        return { QUuid(), QUuid() };
+    auto qpl = PlaylistCollection::getSingleton()->queuePlaylist();
+    QPair<QUuid, QUuid> next = qpl->first();
+    if (!next.second.isNull())
+        return next;
+    QSharedPointer<Item> after = pl->itemAfter(item);
+    if (!after)
+        return { QUuid(), QUuid() };
+    return { pl->uuid(), after->uuid() };
+}
+
+int PlaylistWindow::playOrderRevision(QUuid list)
+{
+    // Both revisions only ever go up, so their sum changes whenever either
+    // the list or the queue does.
+    auto pl = PlaylistCollection::getSingleton()->playlistOf(list);
+    auto qpl = PlaylistCollection::getSingleton()->queuePlaylist();
+    return (pl ? pl->revision() : 0) + qpl->revision();
+}
+
 QUuid PlaylistWindow::getItemBefore(QUuid list, QUuid item)
 {
     auto pl = PlaylistCollection::getSingleton()->playlistOf(list);
@@ -117,10 +155,7 @@ void PlaylistWindow::setMetadata(QUuid list, QUuid item, const QVariantMap &map)
     auto pl = PlaylistCollection::getSingleton()->playlistOf(list);
     if (!pl)
         return;
-    auto i = pl->itemOf(item);
-    if (!i)
-        return;
-    i->setMetadata(map);
+    pl->setItemMetadata(item, map);
 
     auto qdp = currentPlaylistWidget();
     if (qdp->uuid() == list)
@@ -164,16 +199,6 @@ void PlaylistWindow::setExtraPlayTimes(QUuid list, QUuid item, int amount)
     i->setExtraPlayTimes(amount);
 }
 
-QVariantList PlaylistWindow::tabsToVList() const
-{
-    QVariantList qvl;
-    for (int i = 0; i < ui->tabWidget->count(); i++) {
-        auto widget = reinterpret_cast<QDrawnPlaylist *>(ui->tabWidget->widget(i));
-        qvl.append(widget->toVMap());
-    }
-    return qvl;
-}
-
 void PlaylistWindow::tabsFromVList(const QVariantList &qvl)
 {
     ui->tabWidget->clear();
@@ -191,6 +216,32 @@ void PlaylistWindow::tabsFromVList(const QVariantList &qvl)
         addNewTab(QUuid(), tr("Quick Playlist"));
 }
 
+QList<SavedPlaylist> PlaylistWindow::tabsToPlaylists() const
+{
+    QList<SavedPlaylist> playlists;
+    for (int i = 0; i < ui->tabWidget->count(); i++) {
+        auto widget = reinterpret_cast<QDrawnPlaylist *>(ui->tabWidget->widget(i));
+        playlists.append(widget->toSavedPlaylist());
+    }
+    return playlists;
+}
+
+void PlaylistWindow::tabsFromPlaylists(const QList<SavedPlaylist> &playlists)
+{
+    ui->tabWidget->clear();
+    widgets.clear();
+    for (const SavedPlaylist &saved : playlists) {
+        auto qdp = new QDrawnPlaylist();
+        qdp->setDisplayParser(&displayParser);
+        qdp->fromSavedPlaylist(saved);
+        connect(qdp, &QDrawnPlaylist::itemDesired, this, &PlaylistWindow::itemDesired);
+        ui->tabWidget->addTab(qdp, saved.playlist->title());
+        widgets.insert(saved.playlist->uuid(), qdp);
+    }
+    if (widgets.count() < 1)
+        addNewTab(QUuid(), tr("Quick Playlist"));
+}
+
 bool PlaylistWindow::eventFilter(QObject *obj, QEvent *event)
 {
     Q_UNUSED(obj);
@@ -318,12 +369,35 @@ void PlaylistWindow::changePlaylistSelection( QUrl itemUrl, QUuid playlistUuid,
     }
 }
 
-void PlaylistWindow::addSimplePlaylist(QStringList data)
+QUuid PlaylistWindow::newImportedPlaylist()
 {
-
     auto pl = PlaylistCollection::getSingleton()->newPlaylist(tr("New Playlist"));
-    pl->fromStringList(data);
     addNewTab(pl->uuid(), pl->title());
+    return pl->uuid();
+}
+
+void PlaylistWindow::addImportedItems(QUuid list, QList<QSharedPointer<Item>> items)
+{
+    if (widgets.contains(list))
+        widgets[list]->importItems(items);
+}
+
+void PlaylistWindow::setImportProgress(QUuid list, int percent)
+{
+    auto pl = PlaylistCollection::getSingleton()->playlistOf(list);
+    int index = widgets.contains(list) ? ui->tabWidget->indexOf(widgets[list]) : -1;
+    if (!pl || index < 0)
+        return;
+    ui->tabWidget->setTabText(index, QString("%1 (%2%)").arg(pl->title()).arg(percent));
+}
+
+void PlaylistWindow::finishImport(QUuid list)
+{
+    auto pl = PlaylistCollection::getSingleton()->playlistOf(list);
+    int index = widgets.contains(list) ? ui->tabWidget->indexOf(widgets[list]) : -1;
+    if (!pl || index < 0)
+        return;
+    ui->tabWidget->setTabText(index, pl->title());
 }
 
 void PlaylistWindow::setDisplayFormatSpecifier(QString fmt)
@@ -365,7 +439,7 @@ void PlaylistWindow::importTab()
 {
     QString file;
     file = QFileDialog::getOpenFileName(this, tr("Import File"), QString(),
-                                        tr("Playlist files (*.m3u *.m3u8)"));
+                                        tr("Playlist files (*.m3u *.m3u8 *.pls)"));
     if (!file.isEmpty())
         emit importPlaylist(file);
 }
@@ -379,7 +453,7 @@ void PlaylistWindow::exportTab()
                                         tr("Playlist files (*.m3u *.m3u8)"));
     auto pl = PlaylistCollection::getSingleton()->playlistOf(uuid);
     if (!file.isEmpty() && pl)
-        emit exportPlaylist(file, pl->toStringList());
+        emit exportPlaylist(file, uuid);
 }
 
 void PlaylistWindow::copy()
@@ -5,6 +5,7 @@
 #include <QHash>
 #include <QUuid>
 #include "helpers.h"
+#include "storage.h"
 
 namespace Ui {
 class PlaylistWindow;
@@ -24,10 +25,14 @@ public:
 
     void setCurrentPlaylist(QUuid what);
     void clearPlaylist(QUuid what);
+    QUuid currentPlaylistUuid();
     QPair<QUuid, QUuid> addToCurrentPlaylist(QList<QUrl> what);
+    QPair<QUuid, QUuid> addToPlaylist(QUuid list, QList<QUrl> what);
     QPair<QUuid, QUuid> urlToQuickPlaylist(QUrl what);
     bool isCurrentPlaylistEmpty();
     QPair<QUuid, QUuid> getItemAfter(QUuid list, QUuid item);
+    QPair<QUuid, QUuid> peekItemAfter(QUuid list, QUuid item);
+    int playOrderRevision(QUuid list);
     QUuid getItemBefore(QUuid list, QUuid item);
     QUrl getUrlOf(QUuid list, QUuid item);
     void setMetadata(QUuid list, QUuid item, const QVariantMap &map);
@@ -35,8 +40,11 @@ public:
     int extraPlayTimes(QUuid list, QUuid item);
     void setExtraPlayTimes(QUuid list, QUuid item, int amount);
 
-    QVariantList tabsToVList() const;
+    QUuid newImportedPlaylist();
+
     void tabsFromVList(const QVariantList &qvl);
+    QList<SavedPlaylist> tabsToPlaylists() const;
+    void tabsFromPlaylists(const QList<SavedPlaylist> &playlists);
 
 protected:
     bool eventFilter(QObject *obj, QEvent *event);
@@ -58,13 +66,15 @@ signals:
     void windowDocked();
     void itemDesired(QUuid playlistUuid, QUuid itemUuid);
     void importPlaylist(QString fname);
-    void exportPlaylist(QString fname, QStringList items);
+    void exportPlaylist(QString fname, QUuid playlist);
     void quickQueueMode(bool yes);
 
 public slots:
     bool activateItem(QUuid playlistUuid, QUuid itemUuid);
     void changePlaylistSelection(QUrl itemUrl, QUuid playlistUuid, QUuid itemUuid);
-    void addSimplePlaylist(QStringList data);
+    void addImportedItems(QUuid list, QList<QSharedPointer<Item>> items);
+    void setImportProgress(QUuid list, int percent);
+    void finishImport(QUuid list);
     void setDisplayFormatSpecifier(QString fmt);
 
     void newTab();
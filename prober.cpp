@@ -0,0 +1,277 @@
+#include <QThread>
+#include <QtGlobal>
+#include <mpv/client.h>
+#include "prober.h"
+#include "mpvwidget.h"
+#include "playlist.h"
+#include "storage.h"
+
+// Give up on files which take longer than this to open, such as those on
+// mounts that have gone away.
+static const int probeTimeout = 15000;
+
+
+
+ProbeWorker::ProbeWorker(QObject *parent) :
+    QObject(parent), ctrl(NULL), timeout(NULL), state(Idle), size(-1),
+    modified(0)
+{
+}
+
+void ProbeWorker::create()
+{
+    ctrl = new MpvController(this);
+    ctrl->create(false, false);
+    ctrl->setLogLevel(MpvController::LogNone);
+    // Open files paused and without selecting any track, so that only the
+    // demuxer is started.
+    ctrl->setOptionVariant("pause", true);
+    ctrl->setOptionVariant("vid", "no");
+    ctrl->setOptionVariant("aid", "no");
+    ctrl->setOptionVariant("sid", "no");
+    ctrl->setOptionVariant("ytdl", false);
+    connect(ctrl, &MpvController::unhandledMpvEvent,
+            this, &ProbeWorker::ctrl_unhandledMpvEvent);
+
+    timeout = new QTimer(this);
+    timeout->setSingleShot(true);
+    timeout->setInterval(probeTimeout);
+    connect(timeout, &QTimer::timeout,
+            this, &ProbeWorker::timeout_timeout);
+}
+
+void ProbeWorker::probe(QUuid list, QUuid item, QString path)
+{
+    this->list = list;
+    this->item = item;
+    this->path = path;
+
+    if (!MediaInfoCache::identify(path, size, modified)) {
+        emit probed(list, item, QVariantMap());
+        return;
+    }
+    MediaInfo info;
+    if (MediaInfoCache::getSingleton()->lookup(path, size, modified, info)) {
+        emit probed(list, item, info.metadata);
+        return;
+    }
+
+    state = Requested;
+    timeout->start();
+    ctrl->command(QStringList({"loadfile", path}));
+}
+
+void ProbeWorker::ctrl_unhandledMpvEvent(int eventNumber)
+{
+    // Loading a file ends whatever was loaded before it, so end-file is only
+    // taken to mean failure once our file has started.
+    switch (eventNumber) {
+    case MPV_EVENT_START_FILE:
+        if (state == Requested)
+            state = Started;
+        break;
+    case MPV_EVENT_FILE_LOADED:
+        if (state == Started) {
+            MediaInfo info;
+            info.size = size;
+            info.modified = modified;
+            readInfo(info);
+            MediaInfoCache::getSingleton()->insert(path, info);
+            finishProbe(info.metadata);
+        }
+        break;
+    case MPV_EVENT_END_FILE:
+        if (state == Started) {
+            // remember files mpv can't open, so they aren't tried again
+            MediaInfo info;
+            info.size = size;
+            info.modified = modified;
+            MediaInfoCache::getSingleton()->insert(path, info);
+            finishProbe(QVariantMap());
+        }
+        break;
+    }
+}
+
+void ProbeWorker::timeout_timeout()
+{
+    if (state != Idle) {
+        // remembered like a file that can't be opened, so that an unreachable
+        // mount isn't waited on again at every start
+        MediaInfo info;
+        info.size = size;
+        info.modified = modified;
+        MediaInfoCache::getSingleton()->insert(path, info);
+        finishProbe(QVariantMap());
+    }
+}
+
+void ProbeWorker::finishProbe(const QVariantMap &metadata)
+{
+    state = Idle;
+    timeout->stop();
+    ctrl->command(QStringList({"stop"}));
+    emit probed(list, item, metadata);
+}
+
+void ProbeWorker::readInfo(MediaInfo &info)
+{
+    // Keys are lowercased in the same way as MpvWidget does for playback.
+    QVariantMap map;
+    QVariantMap tags = ctrl->getPropertyVariant("metadata").toMap();
+    for (auto i = tags.constBegin(); i != tags.constEnd(); ++i)
+        map.insert(i.key().toLower(), i.value());
+
+    QVariant duration = ctrl->getPropertyVariant("duration");
+    if (!duration.canConvert<MpvErrorCode>()) {
+        info.duration = duration.toDouble();
+        map.insert("duration", info.duration);
+    }
+
+    info.tracks = Helpers::listFromVList<MediaTrack>(
+                ctrl->getPropertyVariant("track-list").toList());
+    for (const MediaTrack &track : info.tracks) {
+        if (track.type != MediaTrack::VideoTrack
+                && track.type != MediaTrack::AudioTrack)
+            continue;
+        QString key = track.typeName() + "-codec";
+        if (!map.contains(key))
+            map.insert(key, track.codec);
+    }
+    info.chapters = Helpers::listFromVList<MediaChapter>(
+                ctrl->getPropertyVariant("chapter-list").toList());
+    info.metadata = map;
+}
+
+
+
+MetadataProber::MetadataProber(QObject *parent) : QObject(parent)
+{
+}
+
+MetadataProber::~MetadataProber()
+{
+    for (Worker &w : workers) {
+        w.thread->quit();
+        w.thread->wait();
+        delete w.thread;
+    }
+}
+
+void MetadataProber::playlistAdded(QSharedPointer<Playlist> playlist)
+{
+    if (playlist == PlaylistCollection::getSingleton()->queuePlaylist())
+        return;
+    QUuid list = playlist->uuid();
+    for (const QSharedPointer<Item> &item : playlist->snapshot())
+        enqueue(list, item);
+    dispatch();
+}
+
+void MetadataProber::itemsInserted(QUuid list, QUuid before,
+                                   QList<QSharedPointer<Item>> items)
+{
+    Q_UNUSED(before);
+    // Queued items are the same files as in their own playlist, so they are
+    // probed there.
+    if (list == PlaylistCollection::getSingleton()->queuePlaylist()->uuid())
+        return;
+    for (const QSharedPointer<Item> &item : items)
+        enqueue(list, item);
+    dispatch();
+}
+
+void MetadataProber::worker_probed(QUuid list, QUuid item, QVariantMap metadata)
+{
+    for (Worker &w : workers)
+        if (w.worker == sender())
+            w.busy = false;
+    pendingItems.remove(item);
+    mergeMetadata(list, item, metadata);
+    dispatch();
+}
+
+void MetadataProber::enqueue(const QUuid &list, const QSharedPointer<Item> &item)
+{
+    QUrl url = item->url();
+    if (!url.isLocalFile() || pendingItems.contains(item->uuid()))
+        return;
+    auto seen = seenItems.constFind(item->uuid());
+    if (seen != seenItems.constEnd() && seen.value() == url)
+        return;
+    seenItems.insert(item->uuid(), url);
+
+    // a codec is only ever known from probing, so its absence marks the
+    // items which still need it
+    QVariantMap metadata = item->metadata();
+    if (metadata.contains("audio-codec") || metadata.contains("video-codec"))
+        return;
+    // Files probed before, even without success, are taken from the cache
+    // as they are, rather than looking at each of them on the disk again.
+    QString path = url.toLocalFile();
+    MediaInfo info;
+    if (MediaInfoCache::getSingleton()->lookup(path, info)) {
+        mergeMetadata(list, item->uuid(), info.metadata);
+        return;
+    }
+    pending.enqueue({ list, item->uuid(), path });
+    pendingItems.insert(item->uuid());
+}
+
+void MetadataProber::dispatch()
+{
+    if (pending.isEmpty())
+        return;
+    if (workers.isEmpty())
+        startWorkers();
+    for (Worker &w : workers) {
+        if (pending.isEmpty())
+            break;
+        if (w.busy)
+            continue;
+        Request r = pending.dequeue();
+        w.busy = true;
+        QMetaObject::invokeMethod(w.worker, "probe", Qt::QueuedConnection,
+                                  Q_ARG(QUuid, r.list), Q_ARG(QUuid, r.item),
+                                  Q_ARG(QString, r.path));
+    }
+}
+
+void MetadataProber::mergeMetadata(const QUuid &list, const QUuid &item,
+                                   const QVariantMap &metadata)
+{
+    // Merge into whatever the item has, as it may have been played or
+    // imported with a title in the meantime.
+    if (metadata.isEmpty())
+        return;
+    auto pl = PlaylistCollection::getSingleton()->playlistOf(list);
+    QSharedPointer<Item> i = pl ? pl->itemOf(item) : QSharedPointer<Item>();
+    if (!i)
+        return;
+    QVariantMap merged = i->metadata();
+    for (auto j = metadata.constBegin(); j != metadata.constEnd(); ++j)
+        merged.insert(j.key(), j.value());
+    if (merged != i->metadata())
+        emit metadataProbed(list, item, merged);
+}
+
+void MetadataProber::startWorkers()
+{
+    // Probing mostly waits on the disk, so a few instances are plenty and
+    // more would only compete with playback for it.
+    int count = qBound(1, QThread::idealThreadCount() / 2, 3);
+    for (int i = 0; i < count; i++) {
+        Worker w;
+        w.thread = new QThread();
+        w.worker = new ProbeWorker();
+        w.worker->moveToThread(w.thread);
+        w.busy = false;
+        connect(w.thread, &QThread::finished,
+                w.worker, &ProbeWorker::deleteLater);
+        connect(w.worker, &ProbeWorker::probed,
+                this, &MetadataProber::worker_probed, Qt::QueuedConnection);
+        w.thread->start();
+        QMetaObject::invokeMethod(w.worker, "create", Qt::QueuedConnection);
+        workers.append(w);
+    }
+}
@@ -0,0 +1,105 @@
+#ifndef PROBER_H
+#define PROBER_H
+
+#include <QHash>
+#include <QObject>
+#include <QQueue>
+#include <QSet>
+#include <QSharedPointer>
+#include <QTimer>
+#include <QUrl>
+#include <QUuid>
+#include <QVariantMap>
+#include <QVector>
+
+class QThread;
+class Item;
+class Playlist;
+class MpvController;
+struct MediaInfo;
+
+// ProbeWorker owns a headless mpv instance on its own thread, and reads the
+// metadata, tracks and chapters of one file at a time by loading it paused
+// with every track disabled.
+class ProbeWorker : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ProbeWorker(QObject *parent = 0);
+
+signals:
+    void probed(QUuid list, QUuid item, QVariantMap metadata);
+
+public slots:
+    void create();
+    void probe(QUuid list, QUuid item, QString path);
+
+private slots:
+    void ctrl_unhandledMpvEvent(int eventNumber);
+    void timeout_timeout();
+
+private:
+    void finishProbe(const QVariantMap &metadata);
+    void readInfo(MediaInfo &info);
+
+    enum ProbeState { Idle, Requested, Started };
+
+    MpvController *ctrl;
+    QTimer *timeout;
+    ProbeState state;
+    QUuid list;
+    QUuid item;
+    QString path;
+    qint64 size;
+    qint64 modified;
+};
+
+// MetadataProber watches the playlists for local files which have not been
+// probed yet, and hands them out to a small pool of ProbeWorkers so that
+// their metadata can be shown without playing them first.  A file is only
+// ever probed once, whether or not it could be opened, and is read afresh
+// when it is played.
+class MetadataProber : public QObject
+{
+    Q_OBJECT
+public:
+    explicit MetadataProber(QObject *parent = 0);
+    ~MetadataProber();
+
+signals:
+    void metadataProbed(QUuid list, QUuid item, QVariantMap metadata);
+
+public slots:
+    void playlistAdded(QSharedPointer<Playlist> playlist);
+    void itemsInserted(QUuid list, QUuid before, QList<QSharedPointer<Item>> items);
+
+private slots:
+    void worker_probed(QUuid list, QUuid item, QVariantMap metadata);
+
+private:
+    struct Request {
+        QUuid list;
+        QUuid item;
+        QString path;
+    };
+    struct Worker {
+        QThread *thread;
+        ProbeWorker *worker;
+        bool busy;
+    };
+
+    void enqueue(const QUuid &list, const QSharedPointer<Item> &item);
+    void dispatch();
+    void startWorkers();
+    void mergeMetadata(const QUuid &list, const QUuid &item,
+                       const QVariantMap &metadata);
+
+    QQueue<Request> pending;
+    QSet<QUuid> pendingItems;
+    // The url each item had when it was last looked at, so that items which
+    // are only moved are passed over
+    QHash<QUuid, QUrl> seenItems;
+    QVector<Worker> workers;
+};
+
+#endif // PROBER_H
@@ -4,20 +4,23 @@
 #include <QFontMetrics>
 #include <QMenu>
 #include <QKeyEvent>
+#include <QDropEvent>
+#include <algorithm>
 #include "qdrawnplaylist.h"
 #include "playlist.h"
 #include "helpers.h"
 
-PlayPainter::PlayPainter(QObject *parent) : QAbstractItemDelegate(parent) {}
+PlayPainter::PlayPainter(QObject *parent) : QAbstractItemDelegate(parent),
+    cache(4096) {}
 
 void PlayPainter::paint(QPainter *painter, const QStyleOptionViewItem &option,
                         const QModelIndex &index) const
 {
     auto playWidget = qobject_cast<QDrawnPlaylist*>(parent());
-    auto p = playWidget->playlist();
-    if (p == NULL)
+    auto model = qobject_cast<const PlaylistModel*>(index.model());
+    if (!model)
         return;
-    QSharedPointer<Item> i = p->itemOf(QUuid(index.data(Qt::DisplayRole).toString()));
+    QSharedPointer<Item> i = model->itemAt(index.row());
     if (i == NULL)
         return;
 
@@ -33,24 +36,41 @@ void PlayPainter::paint(QPainter *painter, const QStyleOptionViewItem &option,
                                        painter);
     QRect rc = option.rect.adjusted(3,0,-3,0);
 
-    if (i->queuePosition() || i->extraPlayTimes()) {
-        QString extraText;
-        if (i->queuePosition())
-            extraText.append(QString::number(i->queuePosition()));
-        if (i->extraPlayTimes())
-            extraText.append(QString("+%1").arg(i->extraPlayTimes()));
-        int extraTextWidth = painter->fontMetrics().width(extraText);
-        QRect rc2(rc);
-        rc2.setLeft(rc.right() - extraTextWidth);
-        painter->drawText(rc2, Qt::AlignRight|Qt::AlignVCenter, extraText);
-        rc.adjust(0, 0, -(3 + extraTextWidth), 0);
+    DisplayParser *dp = playWidget->displayParser();
+    int parserRevision = dp ? dp->revision() : -1;
+    RenderedRow *row = cache.object(i->uuid());
+    if (!row || row->version != i->version()
+            || row->parserRevision != parserRevision) {
+        row = new RenderedRow;
+        row->version = i->version();
+        row->parserRevision = parserRevision;
+        row->label = i->toDisplayString();
+        if (dp) {
+            // TODO: detect what type of file is being played
+            row->label = dp->parseMetadata(i->metadata(), row->label,
+                                           Helpers::VideoFile);
+        }
+        row->queuePosition = -1;
+        row->extraPlayTimes = -1;
+        cache.insert(i->uuid(), row);
+    }
+    if (row->queuePosition != i->queuePosition()
+            || row->extraPlayTimes != i->extraPlayTimes()) {
+        row->queuePosition = i->queuePosition();
+        row->extraPlayTimes = i->extraPlayTimes();
+        row->extraText.clear();
+        if (row->queuePosition)
+            row->extraText.append(QString::number(row->queuePosition));
+        if (row->extraPlayTimes)
+            row->extraText.append(QString("+%1").arg(row->extraPlayTimes));
+        row->extraTextWidth = painter->fontMetrics().width(row->extraText);
     }
 
-    DisplayParser *dp = playWidget->displayParser();
-    QString text = i->toDisplayString();
-    if (dp) {
-        // TODO: detect what type of file is being played
-        text = dp->parseMetadata(i->metadata(), text, Helpers::VideoFile);
+    if (!row->extraText.isEmpty()) {
+        QRect rc2(rc);
+        rc2.setLeft(rc.right() - row->extraTextWidth);
+        painter->drawText(rc2, Qt::AlignRight|Qt::AlignVCenter, row->extraText);
+        rc.adjust(0, 0, -(3 + row->extraTextWidth), 0);
     }
 
     QFont f = playWidget->font();
@@ -58,7 +78,7 @@ void PlayPainter::paint(QPainter *painter, const QStyleOptionViewItem &option,
     painter->setFont(f);
     painter->setPen(playWidget->palette().text().color());
     painter->drawText(rc, Qt::AlignLeft|Qt::AlignVCenter,
-                      text);
+                      row->label);
     painter->setFont(playWidget->font());
 }
 
@@ -71,56 +91,214 @@ QSize PlayPainter::sizeHint(const QStyleOptionViewItem &option,
                                                    option.rect.size());
 }
 
-PlayItem::PlayItem(const QUuid &uuid, const QUuid &playlistUuid,
-                   QListWidget *parent)
-    : QListWidgetItem(parent, QListWidgetItem::UserType)
+void PlayPainter::clearCache()
 {
-    playlistUuid_ = playlistUuid;
-    uuid_ = uuid;
-    setData(Qt::DisplayRole, uuid.toString());
+    cache.clear();
 }
 
-PlayItem::~PlayItem()
+PlaylistModel::PlaylistModel(QObject *parent) : QAbstractListModel(parent),
+    tailFrom(0), indexedRows(0)
 {
 
 }
 
-QUuid PlayItem::playlistUuid()
+int PlaylistModel::rowCount(const QModelIndex &parent) const
 {
-    return playlistUuid_;
+    return parent.isValid() ? 0 : items.count() + tail.count() - tailFrom;
 }
 
-QUuid PlayItem::uuid()
+QVariant PlaylistModel::data(const QModelIndex &index, int role) const
 {
-    return uuid_;
+    QSharedPointer<Item> item = index.isValid() ? itemAt(index.row())
+                                                : QSharedPointer<Item>();
+    if (!item)
+        return QVariant();
+    if (role == Qt::DisplayRole)
+        return item->toDisplayString();
+    return QVariant();
+}
+
+Qt::ItemFlags PlaylistModel::flags(const QModelIndex &index) const
+{
+    // Rows can only be dropped between, never onto, other rows
+    if (!index.isValid())
+        return Qt::ItemIsDropEnabled;
+    return Qt::ItemIsSelectable | Qt::ItemIsEnabled | Qt::ItemIsDragEnabled;
+}
+
+Qt::DropActions PlaylistModel::supportedDropActions() const
+{
+    return Qt::MoveAction;
 }
 
-QDrawnPlaylist::QDrawnPlaylist(QWidget *parent) : QListWidget(parent),
-    displayParser_(NULL), worker(NULL), searcher(NULL)
+bool PlaylistModel::removeRows(int row, int count, const QModelIndex &parent)
+{
+    if (parent.isValid() || count <= 0 || row < 0 || row + count > items.count())
+        return false;
+    beginRemoveRows(QModelIndex(), row, row + count - 1);
+    for (int i = row; i < row + count; i++)
+        rowsByUuid.remove(items.at(i)->uuid());
+    unindexFrom(row);
+    items.remove(row, count);
+    endRemoveRows();
+    return true;
+}
+
+QSharedPointer<Item> PlaylistModel::itemAt(int row) const
+{
+    if (row < 0 || row >= rowCount())
+        return QSharedPointer<Item>();
+    if (row < items.count())
+        return items.at(row);
+    return tail.at(tailFrom + row - items.count());
+}
+
+int PlaylistModel::rowOf(const QUuid &uuid) const
+{
+    auto found = rowsByUuid.constFind(uuid);
+    if (found != rowsByUuid.constEnd() && found.value() < indexedRows)
+        return found.value();
+    int rows = rowCount();
+    if (indexedRows == rows)
+        return -1;
+
+    for (int i = indexedRows; i < rows; i++)
+        rowsByUuid.insert(itemAt(i)->uuid(), i);
+    indexedRows = rows;
+    return rowsByUuid.value(uuid, -1);
+}
+
+void PlaylistModel::filterItems(const QList<QSharedPointer<Item>> &playlistItems)
+{
+    // Walk the playlist alongside the rows, which are in the same order, and
+    // take out or put in each run of items whose hidden state has changed.
+    // The rows that stay are never touched, so the view keeps its selection
+    // and scroll position.
+    tail.swap(items);
+    tailFrom = 0;
+    items.reserve(playlistItems.count());
+    int cursor = 0;
+    QVector<QSharedPointer<Item>> adding;
+
+    auto flushRemoved = [&]() {
+        int count = cursor - tailFrom;
+        if (count <= 0)
+            return;
+        int row = items.count();
+        beginRemoveRows(QModelIndex(), row, row + count - 1);
+        for (int i = tailFrom; i < cursor; i++)
+            rowsByUuid.remove(tail.at(i)->uuid());
+        unindexFrom(row);
+        tailFrom = cursor;
+        endRemoveRows();
+    };
+    auto flushAdded = [&]() {
+        if (adding.isEmpty())
+            return;
+        int row = items.count();
+        beginInsertRows(QModelIndex(), row, row + adding.count() - 1);
+        unindexFrom(row);
+        items += adding;
+        endInsertRows();
+        adding.clear();
+    };
+
+    for (const QSharedPointer<Item> &item : playlistItems) {
+        bool shown = !item->hidden();
+        if (cursor < tail.count() && tail.at(cursor) == item) {
+            flushAdded();
+            if (shown) {
+                flushRemoved();
+                items.append(item);
+                tailFrom = ++cursor;
+            } else {
+                ++cursor;
+            }
+        } else if (shown) {
+            flushRemoved();
+            adding.append(item);
+        }
+    }
+    // Whatever is left over is no longer in the playlist at all
+    flushAdded();
+    cursor = tail.count();
+    flushRemoved();
+    tail.clear();
+    tailFrom = 0;
+}
+
+void PlaylistModel::insertItems(int row, const QVector<QSharedPointer<Item>> &items)
+{
+    if (items.isEmpty())
+        return;
+    row = qBound(0, row, this->items.count());
+    beginInsertRows(QModelIndex(), row, row + items.count() - 1);
+    unindexFrom(row);
+    this->items.insert(row, items.count(), QSharedPointer<Item>());
+    std::copy(items.begin(), items.end(), this->items.begin() + row);
+    endInsertRows();
+}
+
+void PlaylistModel::moveItems(int first, int last, int destination)
+{
+    // destination is the row the items are placed before, as it was before
+    // the move took place.
+    if (destination >= first && destination <= last + 1)
+        return;
+    if (!beginMoveRows(QModelIndex(), first, last, QModelIndex(), destination))
+        return;
+    unindexFrom(std::min(first, destination));
+    QVector<QSharedPointer<Item>> moving = items.mid(first, last - first + 1);
+    items.remove(first, moving.count());
+    if (destination > last)
+        destination -= moving.count();
+    items.insert(destination, moving.count(), QSharedPointer<Item>());
+    std::copy(moving.begin(), moving.end(), items.begin() + destination);
+    endMoveRows();
+}
+
+void PlaylistModel::clear()
+{
+    beginResetModel();
+    items.clear();
+    rowsByUuid.clear();
+    indexedRows = 0;
+    endResetModel();
+}
+
+void PlaylistModel::unindexFrom(int row)
+{
+    indexedRows = std::min(indexedRows, row);
+}
+
+QDrawnPlaylist::QDrawnPlaylist(QWidget *parent) : QListView(parent),
+    model_(NULL), displayParser_(NULL), worker(NULL), searcher(NULL)
 {
     worker = new QThread();
     worker->start();
     searcher = new PlaylistSearcher();
     searcher->moveToThread(worker);
 
+    model_ = new PlaylistModel(this);
+    setModel(model_);
+    // Every row is drawn the same height, so the view need not ask each one
+    setUniformItemSizes(true);
     setSelectionMode(QAbstractItemView::ContiguousSelection);
     setDragDropMode(QAbstractItemView::InternalMove);
 
     setItemDelegate(new PlayPainter(this));
 
     connect(worker, &QThread::finished, searcher, &QObject::deleteLater);
-    connect(model(), SIGNAL(rowsAboutToBeMoved(QModelIndex,int,int,QModelIndex,int)),
-            this, SLOT(model_rowsMoved(QModelIndex,int,int,QModelIndex,int)));
     connect(this, &QDrawnPlaylist::searcher_filterPlaylist,
             searcher, &PlaylistSearcher::filterPlaylist,
             Qt::QueuedConnection);
     connect(searcher, &PlaylistSearcher::playlistFiltered,
             this, &QDrawnPlaylist::repopulateItems,
             Qt::QueuedConnection);
-    connect(this, &QDrawnPlaylist::currentItemChanged,
-            this, &QDrawnPlaylist::self_currentItemChanged);
-    connect(this, SIGNAL(itemDoubleClicked(QListWidgetItem*)),
-            this, SLOT(self_itemDoubleClicked(QListWidgetItem*)));
+    connect(selectionModel(), &QItemSelectionModel::currentChanged,
+            this, &QDrawnPlaylist::self_currentChanged);
+    connect(this, &QDrawnPlaylist::doubleClicked,
+            this, &QDrawnPlaylist::self_doubleClicked);
     connect(this, SIGNAL(customContextMenuRequested(QPoint)),
             this, SLOT(self_customContextMenuRequested(QPoint)));
     setContextMenuPolicy(Qt::CustomContextMenu);
@@ -143,9 +321,9 @@ QUuid QDrawnPlaylist::uuid() const
 
 QUuid QDrawnPlaylist::currentItemUuid() const
 {
-    PlayItem *item = reinterpret_cast<PlayItem*>(currentItem());
+    QSharedPointer<Item> item = model_->itemAt(currentIndex().row());
     if (!item)
-        item = reinterpret_cast<PlayItem*>(QListWidget::item(0));
+        item = model_->itemAt(0);
     if (item)
         return item->uuid();
     return QUuid();
@@ -154,63 +332,55 @@ QUuid QDrawnPlaylist::currentItemUuid() const
 QList<QUuid> QDrawnPlaylist::currentItemUuids() const
 {
     QList<QUuid> selected;
-    for (auto i : selectedItems())
-        selected.append(QUuid(i->text()));
+    QModelIndexList rows = selectionModel()->selectedRows();
+    std::sort(rows.begin(), rows.end());
+    for (const QModelIndex &index : rows)
+        selected.append(model_->itemAt(index.row())->uuid());
     return selected;
 }
 
 void QDrawnPlaylist::traverseSelected(std::function<void (QUuid)> callback)
 {
-    for (auto i : selectedItems())
-        callback(QUuid(i->text()));
+    for (const QUuid &uuid : currentItemUuids())
+        callback(uuid);
 }
 
 void QDrawnPlaylist::setCurrentItem(QUuid itemUuid)
 {
-    QList<QListWidgetItem *> items = findItems(itemUuid.toString(), Qt::MatchExactly);
-    if (items.isEmpty())
-        setCurrentRow(-1);
-    else
-        QListWidget::setCurrentItem(items.first());
+    setCurrentRow(model_->rowOf(itemUuid));
 }
 
 void QDrawnPlaylist::scrollToItem(QUuid itemUuid)
 {
-    auto items = findItems(itemUuid.toString(), Qt::MatchExactly);
-    if (items.empty())
+    int row = model_->rowOf(itemUuid);
+    if (row < 0)
         return;
-    auto item = items.first();
-    scrollTo(indexFromItem(item));
+    scrollTo(model_->index(row));
 }
 
 void QDrawnPlaylist::setUuid(const QUuid &uuid)
 {
     uuid_ = uuid;
+    model_->clear();
     repopulateItems();
 }
 
 void QDrawnPlaylist::addItem(QUuid uuid)
 {
-    PlayItem *playItem = new PlayItem(uuid, uuid_, this);
-    QListWidget::addItem(playItem);
+    model_->insertItems(model_->rowCount(), lookupItems({ uuid }));
 }
 
 void QDrawnPlaylist::addItems(const QList<QUuid> &items)
 {
-    for (const QUuid &item : items)
-        QListWidget::addItem(item.toString());
+    model_->insertItems(model_->rowCount(), lookupItems(items));
 }
 
 void QDrawnPlaylist::addItemsAfter(QUuid item, const QList<QUuid> &items)
 {
-    auto matchingRows = findItems(item.toString(), Qt::MatchExactly);
-    if (matchingRows.length() < 1)
+    int row = model_->rowOf(item);
+    if (row < 0)
         return;
-    int itemIndex = row(matchingRows[0]) + 1;
-    for (auto i : items) {
-        PlayItem *playItem = new PlayItem(i);
-        QListWidget::insertItem(itemIndex++, playItem);
-    }
+    model_->insertItems(row + 1, lookupItems(items));
 }
 
 void QDrawnPlaylist::removeItem(QUuid uuid)
@@ -218,17 +388,40 @@ void QDrawnPlaylist::removeItem(QUuid uuid)
     QSharedPointer<Playlist> playlist = this->playlist();
     if (playlist && playlist->contains(uuid))
         playlist->removeItem(uuid);
-    auto matchingRows = findItems(uuid.toString(), Qt::MatchExactly);
-    if (matchingRows.length() > 0)
-        takeItem(row(matchingRows[0]));
+    int row = model_->rowOf(uuid);
+    if (row >= 0)
+        model_->removeRows(row, 1);
+}
+
+void QDrawnPlaylist::removeItems(const QList<QUuid> &uuids)
+{
+    QSharedPointer<Playlist> playlist = this->playlist();
+    if (playlist)
+        playlist->removeItems(uuids);
+
+    QList<int> indicies;
+    for (const QUuid &uuid : uuids) {
+        int row = model_->rowOf(uuid);
+        if (row >= 0)
+            indicies.append(row);
+    }
+    removeItems(indicies);
 }
 
 void QDrawnPlaylist::removeItems(const QList<int> &indicies)
 {
-    QListIterator<int> iterator(indicies);
-    iterator.toBack();
-    while (iterator.hasPrevious())
-        delete takeItem(iterator.previous());
+    // Remove runs of consecutive rows at once, working from the bottom up so
+    // that the rows still to be removed keep their place.
+    QList<int> rows(indicies);
+    std::sort(rows.begin(), rows.end());
+    int index = rows.count() - 1;
+    while (index >= 0) {
+        int last = rows[index];
+        int first = last;
+        while (--index >= 0 && rows[index] >= first - 1)
+            first = rows[index];
+        model_->removeRows(first, last - first + 1);
+    }
 }
 
 void QDrawnPlaylist::removeAll()
@@ -240,6 +433,26 @@ void QDrawnPlaylist::removeAll()
     clear();
 }
 
+void QDrawnPlaylist::clear()
+{
+    model_->clear();
+}
+
+int QDrawnPlaylist::count() const
+{
+    return model_->rowCount();
+}
+
+int QDrawnPlaylist::currentRow() const
+{
+    return currentIndex().row();
+}
+
+void QDrawnPlaylist::setCurrentRow(int row)
+{
+    setCurrentIndex(model_->index(row));
+}
+
 QPair<QUuid,QUuid> QDrawnPlaylist::importUrl(QUrl url)
 {
     QPair<QUuid,QUuid> info;
@@ -249,11 +462,28 @@ QPair<QUuid,QUuid> QDrawnPlaylist::importUrl(QUrl url)
     info.first = uuid_;
     info.second = item->uuid();
     if (currentFilterText.isEmpty() ||
-            PlaylistSearcher::itemMatchesFilter(item, currentFilterList))
-        addItem(item->uuid());
+            PlaylistSearcher::itemMatchesFilter(item->searchKey(), currentFilterList))
+        model_->insertItems(model_->rowCount(), { item });
     return info;
 }
 
+void QDrawnPlaylist::importItems(const QList<QSharedPointer<Item>> &items)
+{
+    QSharedPointer<Playlist> playlist = this->playlist();
+    if (!playlist)
+        return;
+    playlist->addItems(QUuid(), items);
+    auto collection = ItemCollection::getSingleton();
+    QVector<QSharedPointer<Item>> visible;
+    for (const QSharedPointer<Item> &item : items) {
+        collection->storeItem(item);
+        if (currentFilterText.isEmpty() ||
+                PlaylistSearcher::itemMatchesFilter(item->searchKey(), currentFilterList))
+            visible.append(item);
+    }
+    model_->insertItems(model_->rowCount(), visible);
+}
+
 void QDrawnPlaylist::currentToQueue()
 {
     // CHECKME: code for this should be here?
@@ -290,11 +520,26 @@ QVariantMap QDrawnPlaylist::toVMap() const
 void QDrawnPlaylist::fromVMap(const QVariantMap &qvm)
 {
     QVariantMap contents = qvm.value("contents").toMap();
-    QSharedPointer<Playlist> p(new Playlist);
-    p->fromVMap(contents);
-    PlaylistCollection::getSingleton()->addPlaylist(p);
-    setUuid(p->uuid());
-    nowPlayingItem_ = qvm.value("nowplaying").toUuid();
+    SavedPlaylist saved;
+    saved.playlist.reset(new Playlist);
+    saved.playlist->fromVMap(contents);
+    saved.nowPlaying = qvm.value("nowplaying").toUuid();
+    fromSavedPlaylist(saved);
+}
+
+SavedPlaylist QDrawnPlaylist::toSavedPlaylist() const
+{
+    SavedPlaylist saved;
+    saved.playlist = playlist();
+    saved.nowPlaying = nowPlayingItem_;
+    return saved;
+}
+
+void QDrawnPlaylist::fromSavedPlaylist(const SavedPlaylist &saved)
+{
+    PlaylistCollection::getSingleton()->addPlaylist(saved.playlist);
+    setUuid(saved.playlist->uuid());
+    nowPlayingItem_ = saved.nowPlaying;
     setCurrentItem(nowPlayingItem_);
 }
 
@@ -315,8 +560,7 @@ void QDrawnPlaylist::setFilter(QString needles)
 
     currentFilterText = needles;
     currentFilterList = PlaylistSearcher::textToNeedles(needles);
-    searcher->bump();
-    emit searcher_filterPlaylist(playlist(), needles);
+    emit searcher_filterPlaylist(playlist(), needles, searcher->nextGeneration());
 }
 
 bool QDrawnPlaylist::event(QEvent *e)
@@ -331,59 +575,112 @@ bool QDrawnPlaylist::event(QEvent *e)
         }
     }
     end:
-    return QListWidget::event(e);
+    return QListView::event(e);
 }
 
-void QDrawnPlaylist::repopulateItems()
+void QDrawnPlaylist::changeEvent(QEvent *e)
 {
-    clear();
+    // Measured text widths depend on the font
+    if (e->type() == QEvent::FontChange)
+        static_cast<PlayPainter*>(itemDelegate())->clearCache();
+    QListView::changeEvent(e);
+}
 
-    auto playlist = this->playlist();
-    if (playlist == NULL)
+void QDrawnPlaylist::dropEvent(QDropEvent *event)
+{
+    if (event->source() != this) {
+        event->ignore();
         return;
+    }
 
-    auto itemAdder = [&](QSharedPointer<Item> item) {
-        if (!item->hidden())
-            addItem(item->uuid());
-    };
-    playlist->iterateItems(itemAdder);
-    setCurrentItem(lastSelectedItem);
+    QModelIndexList rows = selectionModel()->selectedRows();
+    if (!rows.isEmpty()) {
+        std::sort(rows.begin(), rows.end());
+        QModelIndex target = indexAt(event->pos());
+        int destination = target.isValid() ? target.row() : count();
+        if (target.isValid() && dropIndicatorPosition() == BelowItem)
+            destination++;
+        moveItems(rows.first().row(), rows.last().row(), destination);
+    }
+
+    // The rows have already been moved, so tell the drag not to remove them
+    event->setDropAction(Qt::CopyAction);
+    event->accept();
+    stopAutoScroll();
+    setState(NoState);
+    viewport()->update();
 }
 
-void QDrawnPlaylist::model_rowsMoved(const QModelIndex &parent,
-                                     int start, int end,
-                                     const QModelIndex &destination, int row)
+QUuid QDrawnPlaylist::itemPlaylistUuid(const QSharedPointer<Item> &item) const
 {
-    Q_UNUSED(parent);
-    Q_UNUSED(destination);
+    Q_UNUSED(item);
+    return uuid_;
+}
+
+QVector<QSharedPointer<Item>> QDrawnPlaylist::lookupItems(const QList<QUuid> &uuids) const
+{
+    QVector<QSharedPointer<Item>> found;
     QSharedPointer<Playlist> p = playlist();
     if (p.isNull())
+        return found;
+    found.reserve(uuids.count());
+    for (const QUuid &uuid : uuids) {
+        QSharedPointer<Item> item = p->itemOf(uuid);
+        if (item)
+            found.append(item);
+    }
+    return found;
+}
+
+void QDrawnPlaylist::moveItems(int first, int last, int destination)
+{
+    QSharedPointer<Playlist> p = playlist();
+    if (p.isNull() || (destination >= first && destination <= last + 1))
         return;
-    QListWidgetItem *destinationItem = QListWidget::item(row);
-    QUuid destinationId = destinationItem ? QUuid(destinationItem->text())
-                                          : QUuid();
+    QSharedPointer<Item> destinationItem = model_->itemAt(destination);
+    QUuid destinationId = destinationItem ? destinationItem->uuid() : QUuid();
     QList<QSharedPointer<Item>> itemsToGrab;
-    for (int index = start; index <= end; index++) {
-        QUuid itemUuid = QUuid(QListWidget::item(index)->text());
-        itemsToGrab.append(p->itemOf(itemUuid));
-    }
+    for (int row = first; row <= last; row++)
+        itemsToGrab.append(model_->itemAt(row));
     p->takeItemsRaw(itemsToGrab);
     p->addItems(destinationId, itemsToGrab);
+    model_->moveItems(first, last, destination);
+}
+
+void QDrawnPlaylist::repopulateItems()
+{
+    auto playlist = this->playlist();
+    if (playlist == NULL) {
+        model_->clear();
+        return;
+    }
+
+    // Taking out the current row moves the current index on to a neighbour,
+    // so put it back on the item last chosen whenever that is shown, without
+    // disturbing the selection.
+    QUuid selected = lastSelectedItem;
+    model_->filterItems(playlist->snapshot());
+    lastSelectedItem = selected;
+    int row = model_->rowOf(selected);
+    if (row >= 0 && row != currentRow())
+        selectionModel()->setCurrentIndex(model_->index(row),
+                                          QItemSelectionModel::NoUpdate);
 }
 
-void QDrawnPlaylist::self_currentItemChanged(QListWidgetItem *current,
-                                             QListWidgetItem *previous)
+void QDrawnPlaylist::self_currentChanged(const QModelIndex &current,
+                                         const QModelIndex &previous)
 {
     Q_UNUSED(previous);
-    QUuid uuid;
-    if (current && !(uuid=reinterpret_cast<PlayItem*>(current)->uuid()).isNull())
-        lastSelectedItem = uuid;
+    QSharedPointer<Item> item = model_->itemAt(current.row());
+    if (item)
+        lastSelectedItem = item->uuid();
 }
 
-void QDrawnPlaylist::self_itemDoubleClicked(QListWidgetItem *item)
+void QDrawnPlaylist::self_doubleClicked(const QModelIndex &index)
 {
-    PlayItem *playItem = reinterpret_cast<PlayItem*>(item);
-    itemDesired(playItem->playlistUuid(), playItem->uuid());
+    QSharedPointer<Item> item = model_->itemAt(index.row());
+    if (item)
+        emit itemDesired(itemPlaylistUuid(item), item->uuid());
 }
 
 void QDrawnPlaylist::self_customContextMenuRequested(const QPoint &p)
@@ -392,7 +689,7 @@ void QDrawnPlaylist::self_customContextMenuRequested(const QPoint &p)
     QAction *a = new QAction(m);
     a->setText(tr("Remove"));
     connect(a, &QAction::triggered, [=]() {
-        traverseSelected([this](const QUuid &item) { removeItem(item); });
+        removeItems(currentItemUuids());
     });
     m->addAction(a);
     a = new QAction(m);
@@ -501,11 +798,7 @@ QSharedPointer<Playlist> QDrawnQueue::playlist() const
     return PlaylistCollection::getSingleton()->queuePlaylist();
 }
 
-void QDrawnQueue::addItem(QUuid uuid)
+QUuid QDrawnQueue::itemPlaylistUuid(const QSharedPointer<Item> &item) const
 {
-    auto actualItem = ItemCollection::getSingleton()->itemOf(uuid);
-    if (actualItem.isNull())
-        return;
-    PlayItem *playItem = new PlayItem(uuid, actualItem->playlistUuid(), this);
-    QListWidget::addItem(playItem);
+    return item->playlistUuid();
 }
@@ -1,11 +1,17 @@
 #ifndef QDRAWNPLAYLIST_H
 #define QDRAWNPLAYLIST_H
 
-#include <QListWidget>
+#include <QListView>
+#include <QAbstractListModel>
+#include <QVector>
+#include <QHash>
+#include <QCache>
 #include <QUuid>
 #include <functional>
 #include "playlist.h"
+#include "storage.h"
 
+class QDropEvent;
 class DisplayParser;
 class QThread;
 class PlaylistSearcher;
@@ -17,27 +23,62 @@ public:
                const QModelIndex &index) const;
     QSize sizeHint(const QStyleOptionViewItem &option,
                    const QModelIndex &index) const;
+    void clearCache();
+
+private:
+    // What was last drawn for an item, which stays good until the item's
+    // version or the display format changes.
+    struct RenderedRow {
+        int version;
+        int parserRevision;
+        QString label;
+        int queuePosition;
+        int extraPlayTimes;
+        QString extraText;
+        int extraTextWidth;
+    };
+    mutable QCache<QUuid, RenderedRow> cache;
 };
 
 
-class PlayItem : public QListWidgetItem {
+// PlaylistModel holds a pointer to each visible item of a playlist, and
+// nothing else.  Everything that is drawn is read from the item itself.
+class PlaylistModel : public QAbstractListModel {
+    Q_OBJECT
 public:
-    PlayItem(const QUuid &uuid = QUuid(), const QUuid &playlistUuid = QUuid(), QListWidget *parent = 0);
-    ~PlayItem();
+    PlaylistModel(QObject *parent = 0);
 
-    QUuid playlistUuid();
-    QUuid uuid();
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
+    Qt::ItemFlags flags(const QModelIndex &index) const;
+    Qt::DropActions supportedDropActions() const;
+    bool removeRows(int row, int count, const QModelIndex &parent = QModelIndex());
+
+    QSharedPointer<Item> itemAt(int row) const;
+    int rowOf(const QUuid &uuid) const;
+    void filterItems(const QList<QSharedPointer<Item>> &playlistItems);
+    void insertItems(int row, const QVector<QSharedPointer<Item>> &items);
+    void moveItems(int first, int last, int destination);
+    void clear();
 
 private:
-    QUuid playlistUuid_;
-    QUuid uuid_;
+    void unindexFrom(int row);
+
+    QVector<QSharedPointer<Item>> items;
+    // While filtering, the rows are items followed by tail from tailFrom on,
+    // so that rows can be taken out and put in one run at a time without
+    // shifting everything after them.  tail is empty otherwise.
+    QVector<QSharedPointer<Item>> tail;
+    int tailFrom;
+    // Rows below indexedRows are known to be correct in rowsByUuid.  Rows
+    // from there on are indexed when next looked for, so that a change in
+    // the middle of a long list costs nothing until the index is needed.
+    mutable QHash<QUuid, int> rowsByUuid;
+    mutable int indexedRows;
 };
 
 
-// QDrawnPlaylist abuses a ListWidget's items to store the uuid of playlist
-// items, which is decoded and looked up during drawing.  The alternative is a
-// subclass of QAbstractItemModel with about 1.5x the code.
-class QDrawnPlaylist : public QListWidget {
+class QDrawnPlaylist : public QListView {
     Q_OBJECT
 public:
     QDrawnPlaylist(QWidget *parent = 0);
@@ -50,14 +91,21 @@ public:
     void traverseSelected(std::function<void(QUuid)> callback);
     void setCurrentItem(QUuid itemUuid);
     void scrollToItem(QUuid itemUuid);
-    virtual void addItem(QUuid uuid);
+    void addItem(QUuid uuid);
     void addItems(const QList<QUuid> &items);
     void addItemsAfter(QUuid item, const QList<QUuid> &items);
     void removeItem(QUuid uuid);
+    void removeItems(const QList<QUuid> &uuids);
     void removeItems(const QList<int> &indicies);
     void removeAll();
+    void clear();
+
+    int count() const;
+    int currentRow() const;
+    void setCurrentRow(int row);
 
     QPair<QUuid,QUuid> importUrl(QUrl url);
+    void importItems(const QList<QSharedPointer<Item>> &items);
     void currentToQueue();
 
     QUuid nowPlayingItem();
@@ -65,6 +113,8 @@ public:
 
     QVariantMap toVMap() const;
     void fromVMap(const QVariantMap &qvm);
+    SavedPlaylist toSavedPlaylist() const;
+    void fromSavedPlaylist(const SavedPlaylist &saved);
 
     void setDisplayParser(DisplayParser *parser);
     DisplayParser *displayParser();
@@ -73,10 +123,17 @@ public:
 
 protected:
     bool event(QEvent *e);
+    void changeEvent(QEvent *e);
+    void dropEvent(QDropEvent *event);
+    // The playlist that an item shown in this list belongs to
+    virtual QUuid itemPlaylistUuid(const QSharedPointer<Item> &item) const;
 
 private:
+    QVector<QSharedPointer<Item>> lookupItems(const QList<QUuid> &uuids) const;
+    void moveItems(int first, int last, int destination);
+
     QUuid uuid_;
-    QHash <QUuid, PlayItem*> itemsByUuid;
+    PlaylistModel *model_;
     QUuid lastSelectedItem;
     QUuid nowPlayingItem_;
     DisplayParser *displayParser_;
@@ -89,16 +146,14 @@ signals:
     // for lack of a better term that doesn't conflict with what we already
     // have, when an item is made hot by double clicking.
     void itemDesired(QUuid playlistUuid, QUuid itemUuid);
-    void searcher_filterPlaylist(QSharedPointer<Playlist>, QString text);
+    void searcher_filterPlaylist(QSharedPointer<Playlist>, QString text, int generation);
 
 private slots:
     void repopulateItems();
 
-    void model_rowsMoved(const QModelIndex & parent, int start, int end,
-                         const QModelIndex & destination, int row);
-    void self_currentItemChanged(QListWidgetItem *current,
-                                 QListWidgetItem *previous);
-    void self_itemDoubleClicked(QListWidgetItem *item);
+    void self_currentChanged(const QModelIndex &current,
+                             const QModelIndex &previous);
+    void self_doubleClicked(const QModelIndex &index);
     void self_customContextMenuRequested(const QPoint &p);
 };
 
@@ -106,7 +161,9 @@ private slots:
 class QDrawnQueue : public QDrawnPlaylist {
 public:
     virtual QSharedPointer<Playlist> playlist() const;
-    void addItem(QUuid uuid);
+
+protected:
+    QUuid itemPlaylistUuid(const QSharedPointer<Item> &item) const;
 };
 
 class PlaylistSelectionPrivate;
@@ -0,0 +1,142 @@
+#include <QDir>
+#include <QFileInfo>
+#include <QImageWriter>
+#include <QSaveFile>
+#include <QTimer>
+#include <QtConcurrent/QtConcurrent>
+#include "screenshotter.h"
+#include "mpvwidget.h"
+
+static bool writeImage(const QImage &image, const QString &fileName,
+                       const QByteArray &format, int quality)
+{
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    QImageWriter writer(&file, format);
+    writer.setQuality(quality);
+    if (!writer.write(image)) {
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
+
+
+
+Screenshotter::Screenshotter(MpvWidget *mpvWidget, QObject *parent) :
+    QObject(parent), mpvWidget(mpvWidget), format("jpg"), jpegQuality(90),
+    pngCompression(7), burstSubtitles(false), burstIndex(0), burstCount(0)
+{
+    burstTimer = new QTimer(this);
+    connect(burstTimer, &QTimer::timeout,
+            this, &Screenshotter::burstTimer_timeout);
+}
+
+Screenshotter::~Screenshotter()
+{
+    for (QFuture<void> &f : writes)
+        f.waitForFinished();
+}
+
+void Screenshotter::grab(bool subtitles, const FrameCallback &callback)
+{
+    mpvWidget->grabFrameAsync(subtitles, this, [callback](QVariant v) {
+        if (v.canConvert<QImage>())
+            callback(v.value<QImage>());
+        else
+            callback(QImage());
+    });
+}
+
+void Screenshotter::save(const QImage &image, const QString &fileName)
+{
+    if (image.isNull()) {
+        emit imageFailed(fileName);
+        return;
+    }
+
+    // Take the format from the name when it has a known one, such as when
+    // the user picked it in a save dialog.
+    QByteArray fmt = QFileInfo(fileName).suffix().toLower().toLatin1();
+    if (!QImageWriter::supportedImageFormats().contains(fmt))
+        fmt = format.toLatin1();
+    // Qt takes png compression as a quality, running the other way, and
+    // turns it back with (100 - q) * 9 / 91, so round so as to land on the
+    // same level.
+    int quality = (fmt == "png") ? 100 - (pngCompression * 91 + 8) / 9
+                                 : jpegQuality;
+
+    for (int i = writes.count() - 1; i >= 0; i--)
+        if (writes[i].isFinished())
+            writes.removeAt(i);
+    writes.append(QtConcurrent::run([this, image, fileName, fmt, quality]() {
+        if (writeImage(image, fileName, fmt, quality))
+            emit imageSaved(fileName);
+        else
+            emit imageFailed(fileName);
+    }));
+}
+
+void Screenshotter::capture(const NameSource &name, bool subtitles)
+{
+    grab(subtitles, [this, name](QImage image) {
+        save(image, name());
+    });
+}
+
+void Screenshotter::burst(const NameSource &name, bool subtitles, int count,
+                          int interval)
+{
+    if (count < 1)
+        return;
+    burstName = name;
+    burstSubtitles = subtitles;
+    burstIndex = 0;
+    burstCount = count;
+    burstTimer->start(qMax(interval, 1));
+    burstTimer_timeout();
+}
+
+void Screenshotter::setFormat(const QString &format)
+{
+    this->format = format;
+}
+
+void Screenshotter::setJpegQuality(int64_t quality)
+{
+    jpegQuality = int(qBound<int64_t>(0, quality, 100));
+}
+
+void Screenshotter::setPngCompression(int64_t level)
+{
+    pngCompression = int(qBound<int64_t>(0, level, 9));
+}
+
+void Screenshotter::burstTimer_timeout()
+{
+    if (burstIndex >= burstCount) {
+        burstTimer->stop();
+        return;
+    }
+    // Frames are named once they arrive, so that the name's time matches.
+    int index = ++burstIndex;
+    NameSource name = burstName;
+    grab(burstSubtitles, [this, name, index](QImage image) {
+        save(image, burstFileName(name(), index));
+    });
+    if (burstIndex >= burstCount)
+        burstTimer->stop();
+}
+
+QString Screenshotter::burstFileName(const QString &fileName, int index)
+{
+    // Frames of a burst may be closer together than the template tells
+    // apart, so each is numbered.
+    QFileInfo info(fileName);
+    QString numbered = QString("%1-%2").arg(info.completeBaseName())
+                                       .arg(index, 3, 10, QChar('0'));
+    if (!info.suffix().isEmpty())
+        numbered += "." + info.suffix();
+    return info.dir().filePath(numbered);
+}
@@ -0,0 +1,59 @@
+#ifndef SCREENSHOTTER_H
+#define SCREENSHOTTER_H
+
+#include <QObject>
+#include <QFuture>
+#include <QImage>
+#include <QList>
+#include <functional>
+
+class QTimer;
+class MpvWidget;
+
+// Screenshotter takes frames out of mpv as raw images, and encodes and
+// writes them on the thread pool so that neither playback nor the gui waits
+// on the disk.  Files are written whole or not at all.
+class Screenshotter : public QObject
+{
+    Q_OBJECT
+public:
+    typedef std::function<QString()> NameSource;
+    typedef std::function<void(QImage)> FrameCallback;
+
+    explicit Screenshotter(MpvWidget *mpvWidget, QObject *parent = 0);
+    ~Screenshotter();
+
+    void grab(bool subtitles, const FrameCallback &callback);
+    void save(const QImage &image, const QString &fileName);
+    void capture(const NameSource &name, bool subtitles);
+    void burst(const NameSource &name, bool subtitles, int count, int interval);
+
+signals:
+    void imageSaved(QString fileName);
+    void imageFailed(QString fileName);
+
+public slots:
+    void setFormat(const QString &format);
+    void setJpegQuality(int64_t quality);
+    void setPngCompression(int64_t level);
+
+private slots:
+    void burstTimer_timeout();
+
+private:
+    static QString burstFileName(const QString &fileName, int index);
+
+    MpvWidget *mpvWidget;
+    QString format;
+    int jpegQuality;
+    int pngCompression;
+    QList<QFuture<void>> writes;
+
+    QTimer *burstTimer;
+    NameSource burstName;
+    bool burstSubtitles;
+    int burstIndex;
+    int burstCount;
+};
+
+#endif // SCREENSHOTTER_H
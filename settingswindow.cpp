@@ -354,10 +354,17 @@ void SettingsWindow::setMouseMapDefaults(const QVariantMap &payload)
 
 void SettingsWindow::setAudioDevices(const QList<AudioDevice> &devices)
 {
+    // The list comes from mpv after the settings have been taken, so put the
+    // chosen device back, and apply it once its name is first known.
+    bool firstList = audioDevices.isEmpty();
     audioDevices = devices;
     ui->audioDevice->clear();
     for (const AudioDevice &device : audioDevices)
         ui->audioDevice->addItem(device.displayString());
+    int index = acceptedSettings[ui->audioDevice->objectName()].value.toInt();
+    ui->audioDevice->setCurrentIndex(index);
+    if (firstList && !audioDevices.isEmpty())
+        emit aoOption("audio-device", audioDevices.value(index).deviceName());
 }
 
 
@@ -521,7 +528,8 @@ void SettingsWindow::sendSignals()
     }
 
     int index = WIDGET_LOOKUP(ui->audioDevice).toInt();
-    aoOption("audio-device", audioDevices.value(index).deviceName());
+    if (!audioDevices.isEmpty())
+        aoOption("audio-device", audioDevices.value(index).deviceName());
     index = WIDGET_LOOKUP(ui->audioChannels).toInt();
     aoOption("audio-channels", index < 3 ? SettingMap::indexedValueToText[ui->audioChannels->objectName()][index]
                                          : channelSwitcher());
@@ -579,11 +587,7 @@ void SettingsWindow::sendSignals()
     encodeTemplate(WIDGET_PLACEHOLD_LOOKUP(ui->encodeTemplate));
     screenshotFormat(WIDGET_TO_TEXT(ui->screenshotFormat));
     screenshotJpegQuality(WIDGET_LOOKUP(ui->jpgQuality).toInt());
-    screenshotJpegSmooth(WIDGET_LOOKUP(ui->jpgSmooth).toInt());
-    screenshotJpegSourceChroma(WIDGET_LOOKUP(ui->jpgSourceChroma).toBool());
     screenshotPngCompression(WIDGET_LOOKUP(ui->pngCompression).toInt());
-    screenshotPngFilter(WIDGET_LOOKUP(ui->pngFilter).toInt());
-    screenshotPngColorspace(WIDGET_LOOKUP(ui->pngColorspace).toBool());
     clientDebuggingMessages(WIDGET_LOOKUP(ui->debugClient).toBool());
     timeTooltip(WIDGET_LOOKUP(ui->tweaksTimeTooltip).toBool(),
                 WIDGET_LOOKUP(ui->tweaksTimeTooltipLocation).toInt() == 0);
@@ -700,21 +704,11 @@ void SettingsWindow::on_jpgQuality_valueChanged(int value)
     ui->jpgQualityValue->setText(QString("%1").arg(value, 3, 10, QChar('0')));
 }
 
-void SettingsWindow::on_jpgSmooth_valueChanged(int value)
-{
-    ui->jpgSmoothValue->setText(QString("%1").arg(value, 3, 10, QChar('0')));
-}
-
 void SettingsWindow::on_pngCompression_valueChanged(int value)
 {
     ui->pngCompressionValue->setText(QString::number(value));
 }
 
-void SettingsWindow::on_pngFilter_valueChanged(int value)
-{
-    ui->pngFilterValue->setText(QString::number(value));
-}
-
 void SettingsWindow::on_keysReset_clicked()
 {
     actionEditor->fromVMap(defaultKeyMap);
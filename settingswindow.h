@@ -151,11 +151,7 @@ signals:
 
     void screenshotFormat(const QString &s);
     void screenshotJpegQuality(int64_t value);
-    void screenshotJpegSmooth(int64_t value);
-    void screenshotJpegSourceChroma(bool yes);
     void screenshotPngCompression(int64_t value);
-    void screenshotPngFilter(int64_t value);
-    void screenshotPngColorspace(bool yes);
     void encodeCodecs(const QString &videoCodec, const QString &audioCodec);
     void encodeStreams(bool noVideo, bool noAudio);
     void encodeHardsubs(bool yes);
@@ -215,12 +211,8 @@ private slots:
 
     void on_jpgQuality_valueChanged(int value);
 
-    void on_jpgSmooth_valueChanged(int value);
-
     void on_pngCompression_valueChanged(int value);
 
-    void on_pngFilter_valueChanged(int value);
-
     void on_keysReset_clicked();
 
     void on_shadersAddFile_clicked();
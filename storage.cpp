@@ -1,12 +1,44 @@
 #include <QSettings>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QtEndian>
+#include <QTimer>
+#include <QtConcurrent>
+#include <QThread>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonArray>
+#include <QDateTime>
 #include <QDir>
 #include <QFileInfo>
 #include <QTextStream>
 #include <QUrl>
+#include <algorithm>
+#include <cstring>
 #include "storage.h"
+#include "playlist.h"
+
+// The binary playlist file is laid out as follows, with every number stored
+// as a little endian quint32 and every uuid as 16 raw bytes:
+//
+//   header:    magic, version, string count, playlist count, playlist table,
+//              last journal entry folded in (low half, then high half)
+//   strings:   (string count + 1) offsets, then the string data
+//   playlists: one offset per playlist record
+//   record:    uuid, title string, now playing uuid, item count, items
+//   item:      uuid, url string, metadata string
+//
+// Strings are interned, so a url which is in several playlists is stored
+// once.  Metadata is kept as a QDataStream encoded QVariantMap, and an item
+// without any refers to the noString index.  Files of the first version
+// have no journal number in their header.
+static const char playlistMagic[4] = { 'M', 'P', 'Q', 'L' };
+static const quint32 playlistVersion = 2;
+static const quint32 playlistHeaderSize = 28;
+static const quint32 firstHeaderSize = 20;
+static const quint32 playlistRecordSize = 40;
+static const quint32 playlistItemSize = 24;
+static const quint32 noString = 0xffffffff;
 
 Storage::Storage(QObject *parent) :
     QObject(parent)
@@ -45,29 +77,285 @@ QVariantList Storage::readVList(QString name)
     return doc.array().toVariantList();
 }
 
-QStringList Storage::readM3U(const QString &where)
+QList<PlaylistImage> Storage::imagesOf(const QList<SavedPlaylist> &playlists)
 {
-    QStringList items;
-    QFile file(where);
-    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
-        return QStringList();
-    items = QTextStream(&file).readAll().split("\n");
-    for (int i = 0; i < items.count(); ++i) {
-        items[i] = items[i].trimmed();
-        if (items[i].isEmpty() || items[i].startsWith("#")) {
-            items.removeAt(i);
-            --i;
+    QList<PlaylistImage> images = outlinesOf(playlists);
+    fillImages(images);
+    return images;
+}
+
+QList<PlaylistImage> Storage::outlinesOf(const QList<SavedPlaylist> &playlists)
+{
+    QList<PlaylistImage> images;
+    for (const SavedPlaylist &saved : playlists) {
+        if (saved.playlist.isNull())
+            continue;
+        PlaylistImage image;
+        image.uuid = saved.playlist->uuid();
+        image.title = saved.playlist->title();
+        image.nowPlaying = saved.nowPlaying;
+        image.playlist = saved.playlist;
+        image.outline = saved.playlist->snapshot();
+        images.append(image);
+    }
+    return images;
+}
+
+void Storage::fillImages(QList<PlaylistImage> &images)
+{
+    for (PlaylistImage &image : images) {
+        image.items.clear();
+        image.items.reserve(image.outline.count());
+        image.playlist->readItems(image.outline, [&image](QSharedPointer<Item> item) {
+            image.items.append({ item->uuid(), item->url(), item->metadata() });
+        });
+    }
+}
+
+bool Storage::writePlaylists(QString name, const QList<PlaylistImage> &playlists,
+                             quint64 sequence)
+{
+    QHash<QByteArray, quint32> stringIndex;
+    QList<QByteArray> strings;
+    auto intern = [&](const QByteArray &s) {
+        auto found = stringIndex.constFind(s);
+        if (found != stringIndex.constEnd())
+            return found.value();
+        quint32 index = strings.count();
+        strings.append(s);
+        stringIndex.insert(s, index);
+        return index;
+    };
+    auto internMetadata = [&](const QVariantMap &metadata) {
+        if (metadata.isEmpty())
+            return noString;
+        QByteArray blob;
+        QDataStream ds(&blob, QIODevice::WriteOnly);
+        ds.setVersion(QDataStream::Qt_5_0);
+        ds << metadata;
+        return intern(blob);
+    };
+
+    // Lay out the playlist records first, so that we know every string
+    QByteArray records;
+    QDataStream rs(&records, QIODevice::WriteOnly);
+    rs.setByteOrder(QDataStream::LittleEndian);
+    QList<quint32> recordOffsets;
+    for (const PlaylistImage &image : playlists) {
+        recordOffsets.append(rs.device()->pos());
+        rs.writeRawData(image.uuid.toRfc4122().constData(), 16);
+        rs << intern(image.title.toUtf8());
+        rs.writeRawData(image.nowPlaying.toRfc4122().constData(), 16);
+        rs << quint32(image.items.count());
+        for (const PlaylistImage::Entry &item : image.items) {
+            rs.writeRawData(item.uuid.toRfc4122().constData(), 16);
+            rs << intern(item.url.toEncoded());
+            rs << internMetadata(item.metadata);
         }
     }
-    return items;
+
+    quint32 stringData = playlistHeaderSize + (strings.count() + 1) * 4;
+    quint32 stringEnd = stringData;
+    for (const QByteArray &s : strings)
+        stringEnd += s.size();
+    quint32 padding = (4 - stringEnd % 4) % 4;
+    quint32 playlistTable = stringEnd + padding;
+    quint32 recordsStart = playlistTable + recordOffsets.count() * 4;
+
+    QSaveFile file(QDir(configPath).absoluteFilePath(name + ".bin"));
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    QDataStream out(&file);
+    out.setByteOrder(QDataStream::LittleEndian);
+    out.writeRawData(playlistMagic, 4);
+    out << playlistVersion << quint32(strings.count())
+        << quint32(recordOffsets.count()) << playlistTable
+        << quint32(sequence & 0xffffffff) << quint32(sequence >> 32);
+    quint32 offset = stringData;
+    for (const QByteArray &s : strings) {
+        out << offset;
+        offset += s.size();
+    }
+    out << offset;
+    for (const QByteArray &s : strings)
+        out.writeRawData(s.constData(), s.size());
+    out.writeRawData("\0\0\0", padding);
+    for (quint32 recordOffset : recordOffsets)
+        out << recordsStart + recordOffset;
+    out.writeRawData(records.constData(), records.size());
+    return file.commit();
 }
 
-void Storage::writeM3U(const QString &where, QStringList items)
+bool Storage::readPlaylists(QString name, QList<SavedPlaylist> &playlists,
+                            quint64 &sequence)
 {
-    QFile file(where);
+    QFile file(QDir(configPath).absoluteFilePath(name + ".bin"));
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    qint64 size = file.size();
+    if (size < firstHeaderSize)
+        return false;
+    const uchar *data = file.map(0, size);
+    if (!data)
+        return false;
+
+    // The file is read in place, and a string is only decoded the first time
+    // an item refers to it.
+    auto u32 = [data](quint64 offset) {
+        return qFromLittleEndian<quint32>(data + offset);
+    };
+    auto uuidAt = [data](quint64 offset) {
+        return QUuid::fromRfc4122(QByteArray::fromRawData(
+                                      reinterpret_cast<const char*>(data + offset), 16));
+    };
+    quint32 stringCount = 0;
+    quint32 headerSize = playlistHeaderSize;
+    auto validString = [&](quint32 index) {
+        if (index >= stringCount)
+            return false;
+        quint32 first = u32(headerSize + index * 4);
+        quint32 last = u32(headerSize + (index + 1) * 4);
+        return first <= last && last <= size;
+    };
+    auto bytesAt = [&](quint32 index) {
+        quint32 first = u32(headerSize + index * 4);
+        quint32 last = u32(headerSize + (index + 1) * 4);
+        return QByteArray::fromRawData(reinterpret_cast<const char*>(data + first),
+                                       last - first);
+    };
+    QHash<quint32, QUrl> urls;
+    QHash<quint32, QVariantMap> metadatas;
+    auto urlAt = [&](quint32 index) {
+        auto found = urls.constFind(index);
+        if (found != urls.constEnd())
+            return found.value();
+        QUrl url = QUrl::fromEncoded(bytesAt(index));
+        urls.insert(index, url);
+        return url;
+    };
+    auto metadataAt = [&](quint32 index) {
+        if (index == noString)
+            return QVariantMap();
+        auto found = metadatas.constFind(index);
+        if (found != metadatas.constEnd())
+            return found.value();
+        QVariantMap metadata;
+        QDataStream ds(bytesAt(index));
+        ds.setVersion(QDataStream::Qt_5_0);
+        ds >> metadata;
+        metadatas.insert(index, metadata);
+        return metadata;
+    };
+
+    quint32 version = u32(4);
+    if (version == 1)
+        headerSize = firstHeaderSize;
+    bool valid = std::memcmp(data, playlistMagic, 4) == 0
+            && (version == 1 || version == playlistVersion)
+            && headerSize <= quint64(size);
+    stringCount = valid ? u32(8) : 0;
+    quint32 playlistCount = valid ? u32(12) : 0;
+    quint32 playlistTable = valid ? u32(16) : 0;
+    quint64 folded = valid && version != 1
+            ? u32(20) | quint64(u32(24)) << 32 : 0;
+    valid = valid
+            && headerSize + (quint64(stringCount) + 1) * 4 <= quint64(size)
+            && playlistTable + quint64(playlistCount) * 4 <= quint64(size);
+
+    QList<SavedPlaylist> loaded;
+    for (quint32 p = 0; valid && p < playlistCount; p++) {
+        quint64 record = u32(playlistTable + p * 4);
+        if (record + playlistRecordSize > quint64(size)) {
+            valid = false;
+            break;
+        }
+        quint32 title = u32(record + 16);
+        quint32 itemCount = u32(record + 36);
+        quint64 itemData = record + playlistRecordSize;
+        if (!validString(title)
+                || itemData + quint64(itemCount) * playlistItemSize > quint64(size)) {
+            valid = false;
+            break;
+        }
+
+        QList<QSharedPointer<Item>> items;
+        items.reserve(itemCount);
+        for (quint32 i = 0; i < itemCount; i++) {
+            quint64 itemRecord = itemData + i * playlistItemSize;
+            quint32 url = u32(itemRecord + 16);
+            quint32 metadata = u32(itemRecord + 20);
+            if (!validString(url) || (metadata != noString && !validString(metadata))) {
+                valid = false;
+                break;
+            }
+            items.append(QSharedPointer<Item>::create(uuidAt(itemRecord),
+                                                      urlAt(url),
+                                                      metadataAt(metadata)));
+        }
+        if (!valid)
+            break;
+
+        SavedPlaylist saved;
+        saved.playlist.reset(new Playlist(QString::fromUtf8(bytesAt(title))));
+        saved.playlist->setUuid(uuidAt(record));
+        saved.playlist->addItems(QUuid(), items);
+        saved.nowPlaying = uuidAt(record + 20);
+        loaded.append(saved);
+    }
+    file.unmap(const_cast<uchar*>(data));
+    if (!valid)
+        return false;
+
+    // Only once the whole file is known to be good do the items become
+    // visible to the rest of the program.
+    for (const SavedPlaylist &saved : loaded)
+        saved.playlist->iterateItems([](QSharedPointer<Item> item) {
+            ItemCollection::getSingleton()->storeItem(item);
+        });
+    playlists = loaded;
+    sequence = folded;
+    return true;
+}
+
+QString Storage::filePath(QString fname) const
+{
+    return QDir(configPath).absoluteFilePath(fname);
+}
+
+QString Storage::setAside(QString fname)
+{
+    // Keep a file we could not read under another name instead of letting
+    // it be written over, replacing any that was set aside before.
+    QString from = filePath(fname);
+    QString to = from + ".bad";
+    QFile::remove(to);
+    return QFile::rename(from, to) ? to : QString();
+}
+
+bool Storage::writeM3U(const QString &where, const QSharedPointer<Playlist> &playlist)
+{
+    // Items are written out one at a time as the playlist is walked, and the
+    // file only replaces an existing one once it has been written in full.
+    QSaveFile file(where);
     if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
-        return;
-    QTextStream(&file) << "#EXTM3U\n\n" << items.join("\n");
+        return false;
+    QTextStream out(&file);
+    out.setCodec("UTF-8");
+    out << "#EXTM3U\n\n";
+    playlist->iterateItems([&out](QSharedPointer<Item> item) {
+        QVariantMap metadata = item->metadata();
+        if (metadata.contains("title") || metadata.contains("duration")) {
+            bool ok = false;
+            double duration = metadata.value("duration").toDouble(&ok);
+            QString title = metadata.value("title").toString();
+            out << "#EXTINF:" << (ok && duration > 0 ? qint64(duration + 0.5) : -1)
+                << ',' << (title.isEmpty() ? item->toDisplayString() : title)
+                << '\n';
+        }
+        out << item->toString() << '\n';
+    });
+    out.flush();
+    return out.status() == QTextStream::Ok && file.commit();
 }
 
 void Storage::writeJsonObject(QString fname, const QJsonDocument &doc)
@@ -86,3 +374,579 @@ QJsonDocument Storage::readJsonObject(QString fname)
     QJsonDocument doc = QJsonDocument::fromJson(QTextStream(&file).readAll().toUtf8());
     return doc;
 }
+
+
+
+static const int importBatchSize = 1000;
+static const int importBatchTime = 100;
+
+PlaylistImporter::PlaylistImporter(QObject *parent) :
+    QObject(parent)
+{
+
+}
+
+void PlaylistImporter::readPlaylist(QString fname, QUuid playlist)
+{
+    QFile file(fname);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        emit finished(playlist);
+        return;
+    }
+    this->playlist = playlist;
+    base = QFileInfo(fname).absoluteDir();
+    batch.clear();
+    batchTimer.start();
+
+    QTextStream stream(&file);
+    stream.setCodec("UTF-8");
+    qint64 size = std::max(file.size(), qint64(1));
+    int percent = -1;
+
+    // An m3u #EXTINF line describes the entry that follows it, while pls
+    // entries are spread over numbered keys.  These are sent on once a key
+    // for a later entry turns up.
+    bool pls = false;
+    bool firstLine = true;
+    QString title;
+    double duration = -1;
+    int plsIndex = -1;
+    QString plsFile;
+
+    auto flushPls = [&]() {
+        if (!plsFile.isEmpty())
+            addEntry(plsFile, title, duration);
+        plsFile.clear();
+        title.clear();
+        duration = -1;
+    };
+
+    while (!stream.atEnd()) {
+        if (QThread::currentThread()->isInterruptionRequested())
+            break;
+        QString line = stream.readLine().trimmed();
+        if (line.isEmpty())
+            continue;
+        if (firstLine) {
+            firstLine = false;
+            pls = line.compare("[playlist]", Qt::CaseInsensitive) == 0;
+            if (pls)
+                continue;
+        }
+
+        if (pls) {
+            int equals = line.indexOf('=');
+            if (equals < 0)
+                continue;
+            QString key = line.left(equals).toLower();
+            QString value = line.mid(equals + 1).trimmed();
+            int keyLength = key.startsWith("file") ? 4
+                          : key.startsWith("title") ? 5
+                          : key.startsWith("length") ? 6 : 0;
+            bool ok = false;
+            int index = keyLength ? key.mid(keyLength).toInt(&ok) : 0;
+            if (!ok)
+                continue;
+            if (index != plsIndex) {
+                flushPls();
+                plsIndex = index;
+            }
+            if (keyLength == 4)
+                plsFile = value;
+            else if (keyLength == 5)
+                title = value;
+            else
+                duration = value.toDouble();
+        } else if (line.startsWith('#')) {
+            // #EXTINF:duration [attributes],title -- where the attributes
+            // may hold quoted commas
+            if (!line.startsWith("#EXTINF:", Qt::CaseInsensitive))
+                continue;
+            bool quoted = false;
+            int comma = -1;
+            for (int i = 8; i < line.length() && comma < 0; i++) {
+                if (line.at(i) == '"')
+                    quoted = !quoted;
+                else if (line.at(i) == ',' && !quoted)
+                    comma = i;
+            }
+            QString info = comma < 0 ? line.mid(8) : line.mid(8, comma - 8);
+            title = comma < 0 ? QString() : line.mid(comma + 1).trimmed();
+            bool ok = false;
+            duration = info.section(' ', 0, 0).toDouble(&ok);
+            if (!ok)
+                duration = -1;
+        } else {
+            addEntry(line, title, duration);
+            title.clear();
+            duration = -1;
+        }
+
+        int done = int(file.pos() * 100 / size);
+        if (done != percent) {
+            percent = done;
+            emit progress(playlist, percent);
+        }
+    }
+    if (pls)
+        flushPls();
+    sendBatch(true);
+    emit finished(playlist);
+}
+
+void PlaylistImporter::addEntry(const QString &location, const QString &title,
+                                double duration)
+{
+    // Anything that doesn't look like a url with a scheme is a file path,
+    // which may be relative to the playlist.  Single letter schemes are
+    // windows drive letters.
+    QUrl url(location);
+    if (url.scheme().length() <= 1)
+        url = QUrl::fromLocalFile(QDir::cleanPath(base.absoluteFilePath(location)));
+
+    QVariantMap metadata;
+    if (!title.isEmpty())
+        metadata.insert("title", title);
+    if (duration > 0)
+        metadata.insert("duration", duration);
+    batch.append(QSharedPointer<Item>::create(QUuid::createUuid(), url, metadata));
+    sendBatch();
+}
+
+void PlaylistImporter::sendBatch(bool force)
+{
+    if (batch.isEmpty())
+        return;
+    if (!force && batch.count() < importBatchSize
+            && batchTimer.elapsed() < importBatchTime)
+        return;
+    emit itemsRead(playlist, batch);
+    batch.clear();
+    batchTimer.restart();
+}
+
+static const int journalCompactInterval = 5 * 60 * 1000;
+static const qint64 journalCompactSize = 16 * 1024 * 1024;
+// Entries are gathered for this long before being written out together.
+static const int journalFlushDelay = 250;
+
+PlaylistJournal::PlaylistJournal(Storage *storage, QObject *parent) :
+    QObject(parent), storage(storage), sequence(0), dirty(false)
+{
+    // While the playlist file is being rewritten, the journal that it
+    // replaces is kept under another name until the new file is safe.
+    journalPath = storage->filePath("playlists.journal");
+    foldingPath = storage->filePath("playlists.journal.old");
+    journal.setFileName(journalPath);
+
+    compactTimer = new QTimer(this);
+    compactTimer->setInterval(journalCompactInterval);
+    connect(compactTimer, &QTimer::timeout,
+            this, &PlaylistJournal::compactionDue);
+
+    flushTimer = new QTimer(this);
+    flushTimer->setSingleShot(true);
+    flushTimer->setInterval(journalFlushDelay);
+    connect(flushTimer, &QTimer::timeout,
+            this, &PlaylistJournal::flushTimer_timeout);
+}
+
+PlaylistJournal::~PlaylistJournal()
+{
+    compaction.waitForFinished();
+}
+
+bool PlaylistJournal::exists() const
+{
+    return QFile::exists(journalPath) || QFile::exists(foldingPath);
+}
+
+void PlaylistJournal::replay(QList<SavedPlaylist> &playlists, quint64 folded)
+{
+    // Entries up to folded are already in the playlists, and numbering
+    // carries on from the last entry seen.
+    sequence = qMax(sequence, folded);
+    bool replayed = replayFile(foldingPath, playlists, folded);
+    replayed = replayFile(journalPath, playlists, folded) || replayed;
+    dirty = dirty || replayed;
+}
+
+void PlaylistJournal::start()
+{
+    if (!journal.open(QIODevice::WriteOnly | QIODevice::Append))
+        return;
+    compactTimer->start();
+}
+
+void PlaylistJournal::compact(const QList<SavedPlaylist> &playlists)
+{
+    if (!dirty || !journal.isOpen() || compaction.isRunning())
+        return;
+
+    // Only the lists of items are taken here, as they stand after the entries
+    // so far.  Their details are copied on the worker and may be newer than
+    // that, which does no harm as the entries that changed them set them
+    // again when replayed.
+    images = Storage::outlinesOf(playlists);
+    quint64 folded = sequence;
+    flush();
+
+    // Anything recorded from here on goes into a fresh journal.  If the last
+    // attempt to write the playlist file failed, its journal is still about
+    // and the current one is added to it rather than replacing it.
+    journal.close();
+    if (!QFile::exists(foldingPath)) {
+        journal.rename(foldingPath);
+        journal.setFileName(journalPath);
+    } else {
+        QFile folding(foldingPath);
+        if (journal.open(QIODevice::ReadOnly)
+                && folding.open(QIODevice::WriteOnly | QIODevice::Append)) {
+            folding.write(journal.readAll());
+            journal.remove();
+        }
+        journal.close();
+    }
+    journal.open(QIODevice::WriteOnly | QIODevice::Append);
+    dirty = false;
+
+    // The images are kept here until the next compaction, so that the
+    // playlists they hold are never let go of on the worker.
+    Storage *storage = this->storage;
+    QList<PlaylistImage> *images = &this->images;
+    QString foldingPath = this->foldingPath;
+    compaction = QtConcurrent::run([storage, images, folded, foldingPath]() {
+        Storage::fillImages(*images);
+        if (storage->writePlaylists("playlists", *images, folded))
+            QFile::remove(foldingPath);
+    });
+}
+
+void PlaylistJournal::finish(const QList<SavedPlaylist> &playlists)
+{
+    // Tab order and the playing items are only noted on the way out
+    QVariantList tabs;
+    for (const SavedPlaylist &saved : playlists) {
+        if (saved.playlist.isNull())
+            continue;
+        tabs.append(QVariantMap {
+            { "list", saved.playlist->uuid() },
+            { "nowplaying", saved.nowPlaying }
+        });
+    }
+    append(QVariantMap { { "op", "tabs" }, { "tabs", tabs } });
+    flush();
+    compactTimer->stop();
+    journal.close();
+    compaction.waitForFinished();
+}
+
+void PlaylistJournal::playlistAdded(QSharedPointer<Playlist> playlist)
+{
+    append(QVariantMap {
+        { "op", "newlist" },
+        { "list", playlist->uuid() },
+        { "title", playlist->title() }
+    });
+    QList<QSharedPointer<Item>> items = playlist->snapshot();
+    if (!items.isEmpty())
+        itemsInserted(playlist->uuid(), QUuid(), items);
+}
+
+void PlaylistJournal::playlistRemoved(QUuid playlist)
+{
+    append(QVariantMap { { "op", "droplist" }, { "list", playlist } });
+}
+
+void PlaylistJournal::itemsInserted(QUuid playlist, QUuid before,
+                                    QList<QSharedPointer<Item>> items)
+{
+    QVariantList list;
+    for (const QSharedPointer<Item> &item : items)
+        list.append(item->toVMap());
+    append(QVariantMap {
+        { "op", "insert" },
+        { "list", playlist },
+        { "before", before },
+        { "items", list }
+    });
+}
+
+void PlaylistJournal::itemsRemoved(QUuid playlist, QList<QUuid> items)
+{
+    QVariantList list;
+    for (const QUuid &item : items)
+        list.append(item);
+    append(QVariantMap {
+        { "op", "remove" },
+        { "list", playlist },
+        { "items", list }
+    });
+}
+
+void PlaylistJournal::itemChanged(QUuid playlist, QSharedPointer<Item> item)
+{
+    append(QVariantMap {
+        { "op", "update" },
+        { "list", playlist },
+        { "item", item->toVMap() }
+    });
+}
+
+void PlaylistJournal::playlistCleared(QUuid playlist)
+{
+    append(QVariantMap { { "op", "clear" }, { "list", playlist } });
+}
+
+void PlaylistJournal::titleChanged(QUuid playlist, QString title)
+{
+    append(QVariantMap {
+        { "op", "title" },
+        { "list", playlist },
+        { "title", title }
+    });
+}
+
+void PlaylistJournal::append(const QVariantMap &entry)
+{
+    if (!journal.isOpen())
+        return;
+    QVariantMap numbered(entry);
+    numbered.insert("seq", ++sequence);
+    QByteArray line = QJsonDocument(QJsonObject::fromVariantMap(numbered)).toJson(QJsonDocument::Compact);
+    line.append('\n');
+    pending.append(line);
+    dirty = true;
+    if (!flushTimer->isActive())
+        flushTimer->start();
+}
+
+void PlaylistJournal::flushTimer_timeout()
+{
+    flush();
+    if (journal.size() > journalCompactSize)
+        emit compactionDue();
+}
+
+void PlaylistJournal::flush()
+{
+    flushTimer->stop();
+    if (pending.isEmpty() || !journal.isOpen())
+        return;
+    journal.write(pending);
+    journal.flush();
+    pending.clear();
+}
+
+bool PlaylistJournal::replayFile(const QString &fname, QList<SavedPlaylist> &playlists,
+                                 quint64 folded)
+{
+    QFile file(fname);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    bool replayed = false;
+    while (!file.atEnd()) {
+        // A line cut short by a crash doesn't parse, and is skipped
+        QJsonDocument doc = QJsonDocument::fromJson(file.readLine());
+        if (!doc.isObject())
+            continue;
+        QVariantMap entry = doc.object().toVariantMap();
+        // Entries written before they were numbered are always replayed
+        quint64 seq = entry.value("seq").toULongLong();
+        sequence = qMax(sequence, seq);
+        if (seq && seq <= folded)
+            continue;
+        replayEntry(entry, playlists);
+        replayed = true;
+    }
+    return replayed;
+}
+
+void PlaylistJournal::replayEntry(const QVariantMap &entry, QList<SavedPlaylist> &playlists)
+{
+    QString op = entry.value("op").toString();
+    QUuid list = entry.value("list").toUuid();
+    int index = -1;
+    for (int i = 0; i < playlists.count(); i++) {
+        if (playlists[i].playlist->uuid() == list) {
+            index = i;
+            break;
+        }
+    }
+    QSharedPointer<Playlist> p = index < 0 ? QSharedPointer<Playlist>()
+                                           : playlists[index].playlist;
+
+    if (op == "newlist") {
+        if (p)
+            return;
+        SavedPlaylist saved;
+        saved.playlist.reset(new Playlist(entry.value("title").toString()));
+        saved.playlist->setUuid(list);
+        playlists.append(saved);
+    } else if (op == "tabs") {
+        QList<SavedPlaylist> ordered;
+        for (const QVariant &v : entry.value("tabs").toList()) {
+            QVariantMap tab = v.toMap();
+            for (int i = 0; i < playlists.count(); i++) {
+                if (playlists[i].playlist->uuid() == tab.value("list").toUuid()) {
+                    SavedPlaylist saved = playlists.takeAt(i);
+                    saved.nowPlaying = tab.value("nowplaying").toUuid();
+                    ordered.append(saved);
+                    break;
+                }
+            }
+        }
+        playlists = ordered + playlists;
+    } else if (!p) {
+        return;
+    } else if (op == "droplist") {
+        playlists.removeAt(index);
+    } else if (op == "title") {
+        p->setTitle(entry.value("title").toString());
+    } else if (op == "clear") {
+        p->clear();
+    } else if (op == "remove") {
+        QList<QUuid> uuids;
+        for (const QVariant &v : entry.value("items").toList())
+            uuids.append(v.toUuid());
+        p->removeItems(uuids);
+    } else if (op == "insert") {
+        // Items already in the list are moved to where they were put
+        QList<QSharedPointer<Item>> items;
+        for (const QVariant &v : entry.value("items").toList()) {
+            QSharedPointer<Item> item(new Item());
+            item->fromVMap(v.toMap());
+            QSharedPointer<Item> existing = p->itemOf(item->uuid());
+            if (existing)
+                p->takeItemsRaw({ existing });
+            items.append(item);
+            ItemCollection::getSingleton()->storeItem(item);
+        }
+        p->addItems(entry.value("before").toUuid(), items);
+    } else if (op == "update") {
+        // Only metadata is changed in place, as new urls come as inserts
+        QVariantMap map = entry.value("item").toMap();
+        p->setItemMetadata(map.value("uuid").toUuid(),
+                           map.value("metadata").toMap());
+    }
+}
+
+
+
+static QSharedPointer<MediaInfoCache> mediaInfoCache;
+static const quint32 mediaInfoMagic = 0x4d50494e;    // "MPIN"
+static const quint32 mediaInfoVersion = 2;
+
+QSharedPointer<MediaInfoCache> MediaInfoCache::getSingleton()
+{
+    if (mediaInfoCache.isNull())
+        mediaInfoCache.reset(new MediaInfoCache());
+    return mediaInfoCache;
+}
+
+bool MediaInfoCache::identify(const QString &path, qint64 &size,
+                              qint64 &modified)
+{
+    QFileInfo info(path);
+    if (!info.isFile())
+        return false;
+    size = info.size();
+    modified = info.lastModified().toMSecsSinceEpoch();
+    return true;
+}
+
+bool MediaInfoCache::lookup(const QString &path, qint64 size, qint64 modified,
+                            MediaInfo &info) const
+{
+    QReadLocker locker(&lock);
+    auto found = entries.constFind(path);
+    if (found == entries.constEnd() || found->size != size
+            || found->modified != modified)
+        return false;
+    info = found.value();
+    return true;
+}
+
+bool MediaInfoCache::lookup(const QString &path, MediaInfo &info) const
+{
+    // Whatever was last learnt of the file, without looking at the file to
+    // see whether it has changed since
+    QReadLocker locker(&lock);
+    auto found = entries.constFind(path);
+    if (found == entries.constEnd())
+        return false;
+    info = found.value();
+    return true;
+}
+
+void MediaInfoCache::insert(const QString &path, const MediaInfo &info)
+{
+    QWriteLocker locker(&lock);
+    entries.insert(path, info);
+    dirty = true;
+}
+
+bool MediaInfoCache::load(const QString &fname)
+{
+    QFile file(fname);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_0);
+    quint32 magic, version, count;
+    in >> magic >> version >> count;
+    if (in.status() != QDataStream::Ok || magic != mediaInfoMagic
+            || version != mediaInfoVersion)
+        return false;
+
+    QHash<QString, MediaInfo> read;
+    read.reserve(count);
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+        QString path;
+        MediaInfo info;
+        QVariantList tracks, chapters;
+        in >> path >> info.size >> info.modified >> info.duration
+           >> info.metadata >> tracks >> chapters;
+        info.tracks = Helpers::listFromVList<MediaTrack>(tracks);
+        info.chapters = Helpers::listFromVList<MediaChapter>(chapters);
+        read.insert(path, info);
+    }
+    if (in.status() != QDataStream::Ok)
+        return false;
+
+    QWriteLocker locker(&lock);
+    entries.swap(read);
+    dirty = false;
+    return true;
+}
+
+bool MediaInfoCache::save(const QString &fname)
+{
+    // Written from a copy, so that the cache isn't held up by the disk
+    QHash<QString, MediaInfo> saving;
+    {
+        QWriteLocker locker(&lock);
+        if (!dirty)
+            return true;
+        saving = entries;
+        dirty = false;
+    }
+
+    QSaveFile file(fname);
+    bool saved = file.open(QIODevice::WriteOnly);
+    if (saved) {
+        QDataStream out(&file);
+        out.setVersion(QDataStream::Qt_5_0);
+        out << mediaInfoMagic << mediaInfoVersion << quint32(saving.count());
+        for (auto i = saving.constBegin(); i != saving.constEnd(); ++i)
+            out << i.key() << i->size << i->modified << i->duration
+                << i->metadata << Helpers::listToVList(i->tracks)
+                << Helpers::listToVList(i->chapters);
+        saved = out.status() == QDataStream::Ok && file.commit();
+    }
+    if (!saved) {
+        QWriteLocker locker(&lock);
+        dirty = true;
+    }
+    return saved;
+}
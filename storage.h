@@ -2,6 +2,46 @@
 #define STORAGE_H
 
 #include <QObject>
+#include <QSharedPointer>
+#include <QUuid>
+#include <QUrl>
+#include <QVector>
+#include <QVariantMap>
+#include <QFile>
+#include <QFuture>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QReadWriteLock>
+#include "helpers.h"
+
+class Playlist;
+class Item;
+class QTimer;
+
+// A playlist as it is saved, along with the item that was playing in it
+struct SavedPlaylist {
+    QSharedPointer<Playlist> playlist;
+    QUuid nowPlaying;
+};
+
+// A copy of what is saved of a playlist, which can be written out on another
+// thread while the playlist itself carries on changing.  An outline only
+// holds the items as they were listed, and their details are copied over
+// into items by Storage::fillImages.
+struct PlaylistImage {
+    struct Entry {
+        QUuid uuid;
+        QUrl url;
+        QVariantMap metadata;
+    };
+    QUuid uuid;
+    QString title;
+    QUuid nowPlaying;
+    QVector<Entry> items;
+    QSharedPointer<Playlist> playlist;
+    QList<QSharedPointer<Item>> outline;
+};
 
 class Storage : public QObject
 {
@@ -15,8 +55,17 @@ public:
     void writeVList(QString name, const QVariantList &qvl);
     QVariantList readVList(QString name);
 
-    QStringList readM3U(const QString &where);
-    void writeM3U(const QString &where, QStringList items);
+    static QList<PlaylistImage> imagesOf(const QList<SavedPlaylist> &playlists);
+    static QList<PlaylistImage> outlinesOf(const QList<SavedPlaylist> &playlists);
+    static void fillImages(QList<PlaylistImage> &images);
+    bool writePlaylists(QString name, const QList<PlaylistImage> &playlists,
+                        quint64 sequence = 0);
+    bool readPlaylists(QString name, QList<SavedPlaylist> &playlists,
+                       quint64 &sequence);
+    QString filePath(QString fname) const;
+    QString setAside(QString fname);
+
+    bool writeM3U(const QString &where, const QSharedPointer<Playlist> &playlist);
 
 private:
     void writeJsonObject(QString fname, const QJsonDocument &doc);
@@ -30,4 +79,127 @@ private:
     QString configPath;
 };
 
+
+
+// PlaylistImporter reads m3u, m3u8 and pls files line by line on whichever
+// thread it lives in, and hands over the items it finds in batches as it
+// goes.  Titles and durations from #EXTINF lines or pls entries are put into
+// the items' metadata.
+class PlaylistImporter : public QObject
+{
+    Q_OBJECT
+public:
+    explicit PlaylistImporter(QObject *parent = 0);
+
+signals:
+    void itemsRead(QUuid playlist, QList<QSharedPointer<Item>> items);
+    void progress(QUuid playlist, int percent);
+    void finished(QUuid playlist);
+
+public slots:
+    void readPlaylist(QString fname, QUuid playlist);
+
+private:
+    void addEntry(const QString &location, const QString &title, double duration);
+    void sendBatch(bool force = false);
+
+    QUuid playlist;
+    QDir base;
+    QList<QSharedPointer<Item>> batch;
+    QElapsedTimer batchTimer;
+};
+
+
+
+// PlaylistJournal appends every change made to the playlists to a file as it
+// happens, so that exiting only has to flush what is pending and a crash
+// loses nothing.  Every so often the journal is folded into the playlist
+// file on a worker thread.  Entries are numbered, and the playlist file
+// notes the last one folded into it, so that a journal which was folded in
+// just before a crash has only its newer entries replayed.
+class PlaylistJournal : public QObject
+{
+    Q_OBJECT
+public:
+    explicit PlaylistJournal(Storage *storage, QObject *parent = 0);
+    ~PlaylistJournal();
+
+    bool exists() const;
+    void replay(QList<SavedPlaylist> &playlists, quint64 folded = 0);
+    void start();
+    void compact(const QList<SavedPlaylist> &playlists);
+    void finish(const QList<SavedPlaylist> &playlists);
+
+signals:
+    void compactionDue();
+
+public slots:
+    void playlistAdded(QSharedPointer<Playlist> playlist);
+    void playlistRemoved(QUuid playlist);
+    void itemsInserted(QUuid playlist, QUuid before, QList<QSharedPointer<Item>> items);
+    void itemsRemoved(QUuid playlist, QList<QUuid> items);
+    void itemChanged(QUuid playlist, QSharedPointer<Item> item);
+    void playlistCleared(QUuid playlist);
+    void titleChanged(QUuid playlist, QString title);
+
+private slots:
+    void flushTimer_timeout();
+
+private:
+    void append(const QVariantMap &entry);
+    void flush();
+    bool replayFile(const QString &fname, QList<SavedPlaylist> &playlists,
+                    quint64 folded);
+    static void replayEntry(const QVariantMap &entry, QList<SavedPlaylist> &playlists);
+
+    Storage *storage;
+    QFile journal;
+    QString journalPath;
+    QString foldingPath;
+    QTimer *compactTimer;
+    QTimer *flushTimer;
+    QByteArray pending;
+    quint64 sequence;
+    QList<PlaylistImage> images;
+    QFuture<void> compaction;
+    bool dirty;
+};
+
+
+
+// What was learnt about a file by probing or playing it, along with the size
+// and modification time the file had at the time.  Tracks and chapters are
+// kept as mpv reports them in track-list and chapter-list.
+struct MediaInfo {
+    MediaInfo() : size(-1), modified(0), duration(0) {}
+    qint64 size;
+    qint64 modified;
+    double duration;
+    QVariantMap metadata;
+    MediaTrackList tracks;
+    MediaChapterList chapters;
+};
+
+// MediaInfoCache remembers MediaInfo by path for as long as the file stays
+// the same size and keeps its modification time, so that nothing has to be
+// probed twice.  It may be used from any thread.
+class MediaInfoCache
+{
+public:
+    static QSharedPointer<MediaInfoCache> getSingleton();
+    static bool identify(const QString &path, qint64 &size, qint64 &modified);
+
+    bool lookup(const QString &path, qint64 size, qint64 modified,
+                MediaInfo &info) const;
+    bool lookup(const QString &path, MediaInfo &info) const;
+    void insert(const QString &path, const MediaInfo &info);
+    bool load(const QString &fname);
+    bool save(const QString &fname);
+
+private:
+    mutable QReadWriteLock lock;
+    QHash<QString, MediaInfo> entries;
+    bool dirty = false;
+};
+
 #endif // STORAGE_H
@@ -0,0 +1,415 @@
+#include <QApplication>
+#include <QCryptographicHash>
+#include <QDesktopWidget>
+#include <QDir>
+#include <QFileInfo>
+#include <QImageWriter>
+#include <QLabel>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QThread>
+#include <QVBoxLayout>
+#include <cmath>
+#include <mpv/client.h>
+#include "thumbnailer.h"
+#include "mpvwidget.h"
+#include "storage.h"
+
+// Pictures are taken at least this far apart, and no more of them than this
+// are taken of one file, so that long recordings are spread out instead.
+static const double minimumInterval = 10.0;
+static const int maximumCount = 200;
+static const int thumbnailWidth = 160;
+static const int thumbnailQuality = 80;
+// The memory cache is bounded in kilobytes, and the disk cache in bytes.
+static const int memoryCost = 32 * 1024;
+static const qint64 diskCost = 256 * 1024 * 1024;
+// Give up on files which stall for longer than this between pictures.
+static const int thumbnailTimeout = 15000;
+
+static int imageCost(const QImage &image)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+    qint64 bytes = image.sizeInBytes();
+#else
+    qint64 bytes = image.byteCount();
+#endif
+    return qMax(1, int(bytes / 1024));
+}
+
+// Times are kept in whole milliseconds, which is also how files are named.
+static qint64 toMilliseconds(double time)
+{
+    return qRound64(time * 1000);
+}
+
+static QString thumbnailFile(const QString &cacheDir, const QString &key,
+                             double time)
+{
+    return QDir(cacheDir).filePath(QString("%1-%2.jpg").arg(key)
+                                   .arg(toMilliseconds(time)));
+}
+
+
+
+ThumbnailWorker::ThumbnailWorker(QObject *parent) :
+    QObject(parent), ctrl(NULL), timeout(NULL), state(Idle),
+    interval(minimumInterval),
+    target(0), index(0), count(0)
+{
+}
+
+void ThumbnailWorker::create()
+{
+    ctrl = new MpvController(this);
+    ctrl->create(false, false);
+    ctrl->setLogLevel(MpvController::LogNone);
+    // Decode video but show it nowhere, and only stop on keyframes so that
+    // each picture costs a single decode.
+    ctrl->setOptionVariant("vid", "auto");
+    ctrl->setOptionVariant("sid", "no");
+    ctrl->setOptionVariant("pause", true);
+    ctrl->setOptionVariant("hr-seek", "no");
+    ctrl->setOptionVariant("hwdec", "no");
+    ctrl->setOptionVariant("vd-lavc-fast", true);
+    ctrl->setOptionVariant("vd-lavc-skiploopfilter", "all");
+    ctrl->setOptionVariant("ytdl", false);
+    connect(ctrl, &MpvController::unhandledMpvEvent,
+            this, &ThumbnailWorker::ctrl_unhandledMpvEvent);
+
+    timeout = new QTimer(this);
+    timeout->setSingleShot(true);
+    timeout->setInterval(thumbnailTimeout);
+    connect(timeout, &QTimer::timeout,
+            this, &ThumbnailWorker::timeout_timeout);
+}
+
+void ThumbnailWorker::generate(QString key, QString path, QString cacheDir)
+{
+    if (key == this->key && state != Idle)
+        return;
+    this->key = key;
+    this->path = path;
+    this->cacheDir = cacheDir;
+    trimCache();
+    readCached();
+
+    state = Requested;
+    timeout->start();
+    ctrl->command(QStringList({"loadfile", path}));
+}
+
+void ThumbnailWorker::reload(QString key, double time, QString file)
+{
+    QImage image(file);
+    if (!image.isNull())
+        emit thumbnailReady(key, time, image);
+}
+
+void ThumbnailWorker::stop()
+{
+    if (state != Idle)
+        finish();
+    key.clear();
+}
+
+void ThumbnailWorker::ctrl_unhandledMpvEvent(int eventNumber)
+{
+    // As with probing, end-file only counts once our file has started.
+    // The first playback-restart is that of opening the file, and every one
+    // after it is that of our last seek.
+    switch (eventNumber) {
+    case MPV_EVENT_START_FILE:
+        if (state == Requested)
+            state = Started;
+        break;
+    case MPV_EVENT_FILE_LOADED:
+        if (state == Started) {
+            double duration = ctrl->getPropertyVariant("duration").toDouble();
+            if (duration <= 0) {
+                finish();
+                break;
+            }
+            interval = qMax(minimumInterval, duration / maximumCount);
+            count = int(std::ceil(duration / interval));
+            index = 0;
+            state = Loaded;
+        }
+        break;
+    case MPV_EVENT_PLAYBACK_RESTART:
+        if (state == Loaded) {
+            state = Seeking;
+            seekNext();
+        } else if (state == Seeking) {
+            grab();
+            index++;
+            seekNext();
+        }
+        break;
+    case MPV_EVENT_END_FILE:
+        if (state == Started || state == Loaded || state == Seeking)
+            finish();
+        break;
+    }
+}
+
+void ThumbnailWorker::timeout_timeout()
+{
+    // Pictures already taken are kept, and the rest are tried again the
+    // next time the file is played.
+    if (state != Idle)
+        finish();
+}
+
+void ThumbnailWorker::trimCache()
+{
+    // The oldest pictures go first, but never those of the file at hand.
+    QFileInfoList files = QDir(cacheDir).entryInfoList(
+                QStringList({"*.jpg"}), QDir::Files, QDir::Time | QDir::Reversed);
+    qint64 total = 0;
+    for (const QFileInfo &file : files)
+        total += file.size();
+    for (const QFileInfo &file : files) {
+        if (total <= diskCost)
+            break;
+        if (file.fileName().startsWith(key + "-"))
+            continue;
+        if (QFile::remove(file.filePath()))
+            total -= file.size();
+    }
+}
+
+void ThumbnailWorker::readCached()
+{
+    known.clear();
+    QDir dir(cacheDir);
+    QStringList names = dir.entryList(QStringList({key + "-*.jpg"}),
+                                      QDir::Files);
+    for (const QString &name : names) {
+        bool ok = false;
+        qint64 ms = name.mid(key.length() + 1).section('.', 0, 0).toLongLong(&ok);
+        if (!ok)
+            continue;
+        QImage image(dir.filePath(name));
+        if (image.isNull())
+            continue;
+        known.insert(ms);
+        emit thumbnailReady(key, ms / 1000.0, image);
+    }
+}
+
+void ThumbnailWorker::seekNext()
+{
+    while (index < count && isCovered(index * interval))
+        index++;
+    if (index >= count) {
+        finish();
+        return;
+    }
+    target = index * interval;
+    timeout->start();
+    ctrl->command(QVariantList({"seek", target, "absolute+keyframes"}));
+}
+
+bool ThumbnailWorker::isCovered(double time) const
+{
+    // Keyframe seeks land near rather than on the time asked for, so any
+    // picture within half a step of it will do.
+    qint64 ms = toMilliseconds(time);
+    qint64 slack = qint64(interval * 500);
+    for (qint64 k : known)
+        if (qAbs(k - ms) < slack)
+            return true;
+    return false;
+}
+
+void ThumbnailWorker::grab()
+{
+    // The frame is the one at the keyframe mpv landed on, and is known by
+    // that time rather than the one asked for.  Neighbouring steps can land
+    // on the same keyframe, which is only taken once.
+    QVariant pos = ctrl->getPropertyVariant("time-pos");
+    double time = pos.canConvert<MpvErrorCode>() ? target : pos.toDouble();
+    if (known.contains(toMilliseconds(time)))
+        return;
+
+    QVariant v = ctrl->screenshotRaw(false);
+    if (!v.canConvert<QImage>())
+        return;
+    QImage image = v.value<QImage>().scaledToWidth(thumbnailWidth,
+                                                   Qt::SmoothTransformation);
+    if (image.isNull())
+        return;
+
+    QSaveFile file(thumbnailFile(cacheDir, key, time));
+    if (file.open(QIODevice::WriteOnly)) {
+        QImageWriter writer(&file, "jpg");
+        writer.setQuality(thumbnailQuality);
+        if (writer.write(image))
+            file.commit();
+        else
+            file.cancelWriting();
+    }
+    known.insert(toMilliseconds(time));
+    emit thumbnailReady(key, time, image);
+}
+
+void ThumbnailWorker::finish()
+{
+    state = Idle;
+    timeout->stop();
+    ctrl->command(QStringList({"stop"}));
+}
+
+
+
+Thumbnailer::Thumbnailer(QObject *parent) : QObject(parent)
+{
+    images.setMaxCost(memoryCost);
+    cacheDir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+            + "/thumbnails";
+    QDir().mkpath(cacheDir);
+
+    // The worker decodes alongside playback, so it gives way to it.
+    thread = new QThread();
+    worker = new ThumbnailWorker();
+    worker->moveToThread(thread);
+    connect(thread, &QThread::finished,
+            worker, &QObject::deleteLater);
+    connect(worker, &ThumbnailWorker::thumbnailReady,
+            this, &Thumbnailer::worker_thumbnailReady);
+    thread->start(QThread::LowestPriority);
+    QMetaObject::invokeMethod(worker, "create", Qt::QueuedConnection);
+}
+
+Thumbnailer::~Thumbnailer()
+{
+    thread->quit();
+    thread->wait();
+    delete thread;
+}
+
+QImage Thumbnailer::thumbnailAt(double time)
+{
+    if (times.isEmpty())
+        return QImage();
+
+    auto after = times.lowerBound(time);
+    auto nearest = after;
+    if (after == times.end()
+            || (after != times.begin() && time - (after - 1).key() < after.key() - time))
+        nearest = after - 1;
+
+    QString k = cacheKey(nearest.key());
+    if (QImage *image = images.object(k))
+        return *image;
+    if (!reloading.contains(k)) {
+        reloading.insert(k);
+        QMetaObject::invokeMethod(worker, "reload", Qt::QueuedConnection,
+                                  Q_ARG(QString, currentKey),
+                                  Q_ARG(double, nearest.key()),
+                                  Q_ARG(QString, nearest.value()));
+    }
+    return nearestInMemory(nearest);
+}
+
+void Thumbnailer::setFile(QUrl url)
+{
+    qint64 size = 0;
+    qint64 modified = 0;
+    QString path = url.isLocalFile() ? url.toLocalFile() : QString();
+    if (path.isEmpty() || !MediaInfoCache::identify(path, size, modified)) {
+        currentKey.clear();
+        times.clear();
+        reloading.clear();
+        QMetaObject::invokeMethod(worker, "stop", Qt::QueuedConnection);
+        return;
+    }
+
+    // Files are known by their size and time as well as their path, so that
+    // a file replaced in place is not shown with the old pictures.
+    QByteArray identity = QString("%1\n%2\n%3").arg(path).arg(size)
+            .arg(modified).toUtf8();
+    QString key = QCryptographicHash::hash(identity, QCryptographicHash::Sha1)
+            .toHex().left(16);
+    if (key == currentKey)
+        return;
+    currentKey = key;
+    times.clear();
+    reloading.clear();
+    QMetaObject::invokeMethod(worker, "generate", Qt::QueuedConnection,
+                              Q_ARG(QString, key), Q_ARG(QString, path),
+                              Q_ARG(QString, cacheDir));
+}
+
+void Thumbnailer::worker_thumbnailReady(QString key, double time, QImage image)
+{
+    if (key != currentKey)
+        return;
+    reloading.remove(cacheKey(time));
+    times.insert(time, thumbnailFile(cacheDir, key, time));
+    images.insert(cacheKey(time), new QImage(image), imageCost(image));
+}
+
+QString Thumbnailer::cacheKey(double time) const
+{
+    return QString("%1-%2").arg(currentKey).arg(toMilliseconds(time));
+}
+
+QImage Thumbnailer::nearestInMemory(QMap<double, QString>::const_iterator nearest)
+{
+    // Step outwards from the wanted picture, taking whichever side is closer
+    // each time.
+    auto below = nearest;
+    auto above = nearest + 1;
+    while (below != times.constBegin() || above != times.constEnd()) {
+        bool takeBelow = above == times.constEnd()
+                || (below != times.constBegin()
+                    && nearest.key() - (below - 1).key() < above.key() - nearest.key());
+        auto i = takeBelow ? --below : above++;
+        if (QImage *image = images.object(cacheKey(i.key())))
+            return *image;
+    }
+    return QImage();
+}
+
+
+
+SeekPreview::SeekPreview(QWidget *parent) :
+    QFrame(parent, Qt::ToolTip | Qt::FramelessWindowHint)
+{
+    setFrameStyle(QFrame::Box | QFrame::Plain);
+    setAttribute(Qt::WA_ShowWithoutActivating);
+    setForegroundRole(QPalette::ToolTipText);
+    setBackgroundRole(QPalette::ToolTipBase);
+    setAutoFillBackground(true);
+
+    picture = new QLabel(this);
+    picture->setAlignment(Qt::AlignCenter);
+    caption = new QLabel(this);
+    caption->setAlignment(Qt::AlignCenter);
+
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->setContentsMargins(2, 2, 2, 2);
+    layout->setSpacing(2);
+    layout->addWidget(picture);
+    layout->addWidget(caption);
+}
+
+void SeekPreview::showPreview(const QImage &image, const QString &text,
+                              const QPoint &where, bool above)
+{
+    picture->setPixmap(QPixmap::fromImage(image));
+    caption->setText(text);
+    adjustSize();
+
+    QPoint pos(where.x() - width() / 2,
+               above ? where.y() - height() - 4 : where.y() + 4);
+    QDesktopWidget *desktop = qApp->desktop();
+    QRect screen = desktop->screenGeometry(desktop->screenNumber(where));
+    pos.setX(qBound(screen.left(), pos.x(), screen.right() - width()));
+    pos.setY(qBound(screen.top(), pos.y(), screen.bottom() - height()));
+    move(pos);
+    show();
+    raise();
+}
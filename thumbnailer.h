@@ -0,0 +1,113 @@
+#ifndef THUMBNAILER_H
+#define THUMBNAILER_H
+
+#include <QCache>
+#include <QFrame>
+#include <QImage>
+#include <QMap>
+#include <QObject>
+#include <QSet>
+#include <QTimer>
+#include <QUrl>
+
+class QLabel;
+class QThread;
+class MpvController;
+
+// ThumbnailWorker owns a headless mpv instance on its own thread, and steps
+// through one file at a time by keyframe seeks, taking a small picture at
+// each stop.  Pictures are written to the disk cache as they are made, and
+// any already there are read back instead of being decoded again.  The disk
+// cache is trimmed to size, oldest first, whenever a file is started.
+// Files that stall are given up on, as with probing.
+class ThumbnailWorker : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ThumbnailWorker(QObject *parent = 0);
+
+signals:
+    void thumbnailReady(QString key, double time, QImage image);
+
+public slots:
+    void create();
+    void generate(QString key, QString path, QString cacheDir);
+    void reload(QString key, double time, QString file);
+    void stop();
+
+private slots:
+    void ctrl_unhandledMpvEvent(int eventNumber);
+    void timeout_timeout();
+
+private:
+    void trimCache();
+    void readCached();
+    void seekNext();
+    bool isCovered(double time) const;
+    void grab();
+    void finish();
+
+    enum ThumbnailState { Idle, Requested, Started, Loaded, Seeking };
+
+    MpvController *ctrl;
+    QTimer *timeout;
+    ThumbnailState state;
+    QString key;
+    QString path;
+    QString cacheDir;
+    QSet<qint64> known;
+    double interval;
+    double target;
+    int index;
+    int count;
+};
+
+// Thumbnailer keeps the seek previews of the file being played.  Pictures
+// are held in a cache bounded by memory, and evicted ones are read back from
+// the disk cache by the worker when they are next wanted.  Until then the
+// nearest picture still in memory is shown in their place.
+class Thumbnailer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit Thumbnailer(QObject *parent = 0);
+    ~Thumbnailer();
+
+    QImage thumbnailAt(double time);
+
+public slots:
+    void setFile(QUrl url);
+
+private slots:
+    void worker_thumbnailReady(QString key, double time, QImage image);
+
+private:
+    QString cacheKey(double time) const;
+    QImage nearestInMemory(QMap<double, QString>::const_iterator nearest);
+
+    QThread *thread;
+    ThumbnailWorker *worker;
+    QString cacheDir;
+    QString currentKey;
+    QMap<double, QString> times;
+    QCache<QString, QImage> images;
+    QSet<QString> reloading;
+};
+
+// SeekPreview is the hover tooltip of the position slider when a picture is
+// at hand, showing it above the time text.
+class SeekPreview : public QFrame
+{
+    Q_OBJECT
+public:
+    explicit SeekPreview(QWidget *parent = 0);
+
+    void showPreview(const QImage &image, const QString &text,
+                     const QPoint &where, bool above);
+
+private:
+    QLabel *picture;
+    QLabel *caption;
+};
+
+#endif // THUMBNAILER_H